@@ -52,6 +52,7 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 #include "lookup.h"
 #include "announce.h"
 #include "bucket.h"
+#include "id.h"
 #include "neighborhood.h"
 #include "send_p2p.h"
 
@@ -81,6 +82,7 @@ ANNOUNCE *announce_put( UCHAR *lkp_id, UCHAR *host_id ) {
 
 	/* ID */
 	memcpy( a->lkp_id, lkp_id, SHA_DIGEST_LENGTH );
+	memcpy( a->host_id, host_id, SHA_DIGEST_LENGTH );
 
 	/* Expire after at least 5 seconds  */
 	a->time_find = time_add_x_sec( 10 );
@@ -113,14 +115,17 @@ void announce_expire( void ) {
 	ITEM *i = NULL;
 	ITEM *n = NULL;
 	ANNOUNCE *a = NULL;
+	time_t now = time_now_sec();
 
 	i = _main->announce->list->start;
 	while( i ) {
 		a = i->val;
 		n = list_next( i );
 
-		if( _main->p2p->time_now.tv_sec > a->time_find ) {
+		if( now > a->time_find ) {
 			announce_del( i );
+		} else {
+			announce_retry( a );
 		}
 		i = n;
 	}
@@ -139,24 +144,67 @@ void announce_resolve( UCHAR *lkp_id, UCHAR *node_id, IP *c_addr ) {
 	/* Found the lookup ID */
 
 	/* Now look if this node has already been asked */
-	if( !hash_exists( a->hash, node_id, SHA_DIGEST_LENGTH ) ) {
+	if( hash_exists( a->hash, node_id, SHA_DIGEST_LENGTH ) ) {
+		return;
+	}
 
-		/* Ask the node just once */
-		if( !node_me( node_id ) && _main->conf->hostname != NULL ) {
-			send_announce( c_addr, lkp_id, _main->conf->host_id );
-		}
+	/* Ask the node just once */
+	if( !id_me( node_id ) && _main->conf->hostname != NULL ) {
+		announce_remember( a, node_id, c_addr );
+	}
+}
+
+/* node_id replied: No need to send it again */
+void announce_answered( UCHAR *lkp_id, UCHAR *node_id ) {
+	ITEM *i = NULL;
+	ANNOUNCE *a = NULL;
+	struct obj_announce_node *n = NULL;
+
+	if( ( i = hash_get( _main->announce->hash, lkp_id, SHA_DIGEST_LENGTH )) == NULL ) {
+		return;
+	}
+	a = i->val;
 
-		/* Remember that node */
-		announce_remember( a, node_id );
+	if( ( n = hash_get( a->hash, node_id, SHA_DIGEST_LENGTH ) ) != NULL ) {
+		n->answered = TRUE;
 	}
 }
 
-void announce_remember( ANNOUNCE *a, UCHAR *node_id ) {
-	UCHAR *buffer = NULL;
+/* Remember that node and send the announcement */
+void announce_remember( ANNOUNCE *a, UCHAR *node_id, IP *c_addr ) {
+	struct obj_announce_node *n = NULL;
 
-	/* Remember that node */
-	buffer = (UCHAR *) myalloc( SHA_DIGEST_LENGTH*sizeof(char), "announce_remember" );
-	memcpy( buffer, node_id, SHA_DIGEST_LENGTH );
-	list_put( a->list, buffer );
-	hash_put( a->hash, buffer, SHA_DIGEST_LENGTH, buffer );
+	n = (struct obj_announce_node *) myalloc( sizeof(struct obj_announce_node), "announce_remember" );
+	memcpy( n->id, node_id, SHA_DIGEST_LENGTH );
+	memcpy( &n->c_addr, c_addr, sizeof(IP) );
+	list_put( a->list, n );
+	hash_put( a->hash, n->id, SHA_DIGEST_LENGTH, n );
+
+	announce_send( a, n );
+}
+
+void announce_send( ANNOUNCE *a, struct obj_announce_node *n ) {
+	send_announce( &n->c_addr, a->lkp_id, a->host_id );
+	n->time_sent = time_now_msec();
+	n->timeout = nbhd_timeout( n->id );
+}
+
+/* Announcements get lost too: Send them again to silent nodes */
+void announce_retry( ANNOUNCE *a ) {
+	ITEM *i = NULL;
+	struct obj_announce_node *n = NULL;
+	long long int now = time_now_msec();
+
+	i = a->list->start;
+	while( i ) {
+		n = i->val;
+
+		if( !n->answered && n->retries < ANNOUNCE_RETRIES && now - n->time_sent > n->timeout ) {
+			n->retries++;
+			p2p_loss( TRUE );
+			announce_send( a, n );
+		}
+
+		i = list_next( i );
+	}
 }
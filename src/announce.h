@@ -17,6 +17,9 @@ You should have received a copy of the GNU General Public License
 along with masala.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+/* Resend an unanswered announcement this often */
+#define ANNOUNCE_RETRIES 1
+
 struct obj_announce {
 	LIST *list;
 	HASH *hash;
@@ -27,12 +30,23 @@ struct obj_node_announce {
 	HASH *hash;
 
 	UCHAR lkp_id[SHA_DIGEST_LENGTH+1];
+	UCHAR host_id[SHA_DIGEST_LENGTH];
 
 	IP c_addr;
 	time_t time_find;
 };
 typedef struct obj_node_announce ANNOUNCE;
 
+/* A node that has been asked */
+struct obj_announce_node {
+	UCHAR id[SHA_DIGEST_LENGTH];
+	IP c_addr;
+	long long int time_sent;
+	long int timeout;
+	int retries;
+	int answered;
+};
+
 struct obj_announce *announce_init( void );
 void announce_free( void );
 
@@ -42,4 +56,7 @@ void announce_del( ITEM *i );
 void announce_expire( void );
 
 void announce_resolve( UCHAR *lkp_id, UCHAR *node_id, IP *c_addr );
-void announce_remember( ANNOUNCE *a, UCHAR *node_id );
+void announce_answered( UCHAR *lkp_id, UCHAR *node_id );
+void announce_remember( ANNOUNCE *a, UCHAR *node_id, IP *c_addr );
+void announce_send( ANNOUNCE *a, struct obj_announce_node *n );
+void announce_retry( ANNOUNCE *a );
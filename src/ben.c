@@ -34,8 +34,10 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 #include "log.h"
 #include "ben.h"
 
+static POOL ben_pool = POOL_INIT( sizeof(struct obj_ben), "ben" );
+
 struct obj_ben *ben_init( int type ) {
-	struct obj_ben *node = (struct obj_ben *) myalloc( sizeof(struct obj_ben), "ben_init" );
+	struct obj_ben *node = (struct obj_ben *) pool_alloc( &ben_pool, POOL_DIRTY, "ben_init" );
 
 	node->t = type;
 
@@ -65,7 +67,7 @@ void ben_free( struct obj_ben *node ) {
 	ben_free_r( node );
 
 	/* Delete the last node */
-	myfree( node, "ben_free" );
+	pool_free( &ben_pool, node, "ben_free" );
 }
 
 void ben_free_r( struct obj_ben *node ) {
@@ -120,7 +122,7 @@ ITEM *ben_free_item( struct obj_ben *node, ITEM *item ) {
 	} else {
 		/* Remove ben object */
 		ben_free_r( item->val );
-		myfree( item->val, "ben_free_item" );
+		pool_free( &ben_pool, item->val, "ben_free_item" );
 		item->val = NULL;
 	}
 	
@@ -142,7 +144,7 @@ void raw_free( struct obj_raw *raw ) {
  
 
 struct obj_tuple *tuple_init( struct obj_ben *key, struct obj_ben *val ) {
-	struct obj_tuple *tuple = (struct obj_tuple *) myalloc( sizeof(struct obj_tuple), "tuple_init" );
+	struct obj_tuple *tuple = (struct obj_tuple *) slab_alloc( sizeof(struct obj_tuple), POOL_DIRTY, "tuple_init" );
 	tuple->key = key;
 	tuple->val = val;
 	return tuple;
@@ -151,7 +153,7 @@ struct obj_tuple *tuple_init( struct obj_ben *key, struct obj_ben *val ) {
 void tuple_free( struct obj_tuple *tuple ) {
 	ben_free( tuple->key );
    	ben_free( tuple->val );
-	myfree( tuple, "tuple_item" );
+	slab_free( tuple, sizeof(struct obj_tuple), "tuple_item" );
 }
 
 void ben_dict( struct obj_ben *node, struct obj_ben *key, struct obj_ben *val ) {
@@ -48,282 +48,520 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 #include "udp.h"
 #include "ben.h"
 #include "bucket.h"
+#include "id.h"
+#include "time.h"
+#include "random.h"
 
-LIST *bckt_init( void ) {
-	BUCK *b = (BUCK *) myalloc( sizeof(BUCK), "bckt_init" );
-	LIST *l = (LIST *) list_init();
+NBHD *bckt_init( void ) {
+	NBHD *nbhd = (NBHD *) myalloc( sizeof(NBHD), "bckt_init" );
 
 	/* First bucket */
-	memset( b->id, '\0', SHA_DIGEST_LENGTH );
-	b->nodes = list_init();
+	nbhd->depth = 0;
 
-	/* Connect bucket */
-	list_put( l, b );
+	/* Keep 0 for "never" */
+	nbhd->epoch = time_now_sec() - 1;
 
-	return l;
+	return nbhd;
 }
 
-void bckt_free( LIST *thislist ) {
-	ITEM *i = NULL;
-	BUCK *b = NULL;
+void bckt_free( NBHD *nbhd ) {
+	myfree( nbhd, "bckt_free" );
+}
 
-	i = thislist->start;
-	while( i ) {
-		b = i->val;
+/*
+ * A full bucket keeps its nodes unless one of them went stale. The newcomer
+ * waits in the replacement cache instead and the least recently seen node
+ * is returned in lru, so the caller may check whether it is still alive.
+ * Returns 1 if the node got a slot.
+ */
+int bckt_put( NBHD *nbhd, const UCHAR *id, IP *sa, int direct, NODE *lru ) {
+	unsigned int seen = direct ? bckt_time( nbhd, time_now_sec() ) : 0;
+	BUCK *b = NULL;
+	int index = 0;
+	int i = 0;
 
-		/* Delete node references */
-		list_free( b->nodes );
+	while( 1 ) {
+		index = bckt_index( nbhd, id );
+		b = &nbhd->buckets[index];
 
-		/* Delete bucket */
-		myfree( b, "bckt_free" );
+		if( b->nodes.count < BCKT_K ) {
+			i = b->nodes.count++;
+			break;
+		}
 
-		i = list_next( i );
+		/* Split our own bucket, if it is full */
+		if( index < nbhd->depth || nbhd->depth >= BCKT_COUNT - 1 ) {
+			/* Swap out a stale node right away */
+			i = bckt_slot_stale( &b->nodes );
+			break;
+		}
+		bckt_split( nbhd );
 	}
-	list_free( thislist );
-}
-
-void bckt_put( LIST *l, NODE *n ) {
-	ITEM *i = NULL;
-	BUCK *b = NULL;
 
-	if( n == NULL ) {
-		return;
+	/* Contested slot */
+	if( i < 0 ) {
+		bckt_replace( nbhd, b, id, sa, seen );
+		if( seen > 0 ) {
+			b->time_touched = seen;
+		}
+		lru->s = &b->nodes;
+		lru->i = bckt_slot_oldest( &b->nodes );
+		return 0;
 	}
 
-	if( (i = bckt_find_best_match( l, n->id )) == NULL ) {
-		log_err( "Something is terribly broken: No appropriate bucket found for ID" );
-		return;
+	bckt_slot_init( nbhd, &b->nodes, i, id, sa, seen );
+	if( seen > 0 ) {
+		b->time_touched = seen;
 	}
-	b = i->val;
 
-	if( bckt_find_node( l, n->id ) != NULL ) {
-		/* Node found */
-		return;
+	/* Do not keep the node twice */
+	if( (i = bckt_slot_find( &b->replacements, id )) >= 0 ) {
+		bckt_slot_del( &b->replacements, i );
 	}
 
-	list_put( b->nodes, n );
+	return 1;
 }
 
-void bckt_del( LIST *l, NODE *n ) {
-	ITEM *item_b = NULL;
-	ITEM *item_n = NULL;
-	BUCK *b = NULL;
+void bckt_del( NBHD *nbhd, NODE *n ) {
+	BUCK *b = &nbhd->buckets[bckt_index( nbhd, n->s->id[n->i] )];
 
-	if( n == NULL ) {
-		return;
-	}
+	bckt_slot_del( n->s, n->i );
 
-	if( (item_b = bckt_find_best_match( l, n->id )) == NULL ) {
-		log_err( "Something is terribly broken: No appropriate bucket found for ID" );
-		return;
-	}
-	b = item_b->val;
+	/* Fill the free slot */
+	bckt_refill( b );
+}
 
-	if( (item_n = bckt_find_node( l, n->id )) == NULL ) {
-		/* Node node found */
-		return;
+/* Newcomers wait in the replacement cache for a slot of this bucket */
+int bckt_contested( NBHD *nbhd, NODE *n ) {
+	return nbhd->buckets[bckt_index( nbhd, n->s->id[n->i] )].replacements.count > 0;
+}
+
+/*
+ * Drop every node with at least pinged unanswered pings. One pass per
+ * bucket moves the survivors together, then the free slots get refilled
+ * from the replacement cache. Returns the number of dropped nodes.
+ */
+long int bckt_expire( NBHD *nbhd, int pinged ) {
+	SLOTS *s = NULL;
+	long int expired = 0;
+	int i = 0, j = 0;
+	int k = 0;
+
+	for( k=0; k<=nbhd->depth; k++ ) {
+		s = &nbhd->buckets[k].nodes;
+
+		for( i=0, j=0; i<s->count; i++ ) {
+			if( s->pinged[i] >= pinged ) {
+				continue;
+			}
+			if( i != j ) {
+				bckt_slot_copy( s, i, s, j );
+			}
+			j++;
+		}
+
+		if( j == s->count ) {
+			continue;
+		}
+
+		expired += s->count - j;
+		s->count = j;
+
+		bckt_refill( &nbhd->buckets[k] );
 	}
 
-	/* Delete reference to node */
-	list_del( b->nodes, item_n );
+	nbhd->expired += expired;
+
+	return expired;
 }
 
-ITEM *bckt_find_best_match( LIST *thislist, const UCHAR *id ) {
-	ITEM *item = NULL;
-	ITEM *next = NULL;
-	BUCK *b = NULL;
-	long int i = 0;
+/* The node contacted us just now */
+void bckt_touch( NBHD *nbhd, NODE *n, IP *sa ) {
+	unsigned int now = bckt_time( nbhd, time_now_sec() );
 
-	item = thislist->start;
-	for( i=0; i<thislist->counter-1; i++ ) {
-		next = list_next( item );
-		b = next->val;
+	nbhd->buckets[bckt_index( nbhd, n->s->id[n->i] )].time_touched = now;
+	n->s->time_seen[n->i] = now;
+	n->s->pinged[n->i] = 0;
+	bckt_addr_set( n, sa );
+}
 
-		/* Does this bucket fits better than the next one? */
-		if( memcmp( id, b->id, SHA_DIGEST_LENGTH) < 0 ) {
-			return item;
-		}
+unsigned int bckt_time( NBHD *nbhd, time_t t ) {
+	return ( t > nbhd->epoch ) ? (unsigned int)(t - nbhd->epoch) : 0;
+}
+
+void bckt_addr_get( NODE *n, IP *sa ) {
+	memset( sa, '\0', sizeof(IP) );
+	sa->sin6_family = AF_INET6;
+	memcpy( &sa->sin6_addr, n->s->addr[n->i], 16 );
+	memcpy( &sa->sin6_port, n->s->addr[n->i] + 16, 2 );
+}
+
+void bckt_addr_set( NODE *n, IP *sa ) {
+	memcpy( n->s->addr[n->i], &sa->sin6_addr, 16 );
+	memcpy( n->s->addr[n->i] + 16, &sa->sin6_port, 2 );
+}
+
+void bckt_slot_init( NBHD *nbhd, SLOTS *s, int i, const UCHAR *id, IP *sa, unsigned int seen ) {
+	NODE n = { s, i };
+
+	memcpy( s->id[i], id, SHA_DIGEST_LENGTH );
+	bckt_addr_set( &n, sa );
+
+	/* Nodes we only heard of have to prove that they are alive */
+	s->time_seen[i] = seen;
+	s->pinged[i] = ( seen > 0 ) ? 0 : 1;
+
+	s->time_ping[i] = bckt_time( nbhd, time_add_5_min_approx() );
+
+	s->rtt[i] = 0;
+	s->loss[i] = 0;
+}
+
+int bckt_slot_find( SLOTS *s, const UCHAR *id ) {
+	int i = 0;
 
-		item = next;
+	for( i=0; i<s->count; i++ ) {
+		if( id_equal( s->id[i], id ) ) {
+			return i;
+		}
 	}
 
-	/* No bucket found, so return the last one */
-	return thislist->stop;
+	return -1;
 }
 
-ITEM *bckt_find_any_match( LIST *thislist, const UCHAR *id ) {
-	ITEM *i = NULL;
-	BUCK *b = NULL;
-	long int j = 0;
+void bckt_slot_copy( SLOTS *from, int i, SLOTS *to, int j ) {
+	memcpy( to->id[j], from->id[i], SHA_DIGEST_LENGTH );
+	memcpy( to->addr[j], from->addr[i], BCKT_ADDRLEN );
+	to->time_seen[j] = from->time_seen[i];
+	to->time_ping[j] = from->time_ping[i];
+	to->pinged[j] = from->pinged[i];
+	to->rtt[j] = from->rtt[i];
+	to->loss[j] = from->loss[i];
+}
 
-	i = bckt_find_best_match( thislist, id );
-	b = i->val;
+/* The last slot fills the gap */
+void bckt_slot_del( SLOTS *s, int i ) {
+	int last = --s->count;
 
-	/* Success, */
-	if( b->nodes->counter > 0 ) {
-		return i;
+	if( i != last ) {
+		bckt_slot_copy( s, last, s, i );
 	}
+}
+
+void bckt_slot_move( SLOTS *from, int i, SLOTS *to ) {
+	bckt_slot_copy( from, i, to, to->count++ );
+	bckt_slot_del( from, i );
+}
 
-	/* This bucket is empty: Find another one. */
-	for( j=0; j<thislist->counter; j++ ) {
+int bckt_slot_stale( SLOTS *s ) {
+	int i = 0;
 
-		b = i->val;
-		if( b->nodes->counter > 0 ) {
+	for( i=0; i<s->count; i++ ) {
+		if( s->pinged[i] >= BCKT_STALE ) {
 			return i;
 		}
-		i = list_prev( i );
 	}
 
-	return NULL;
+	return -1;
 }
 
-ITEM *bckt_find_node( LIST *thislist, const UCHAR *id ) {
-	ITEM *item_b = NULL;
-	ITEM *item_n = NULL;
-	BUCK *b = NULL;
-	LIST *list_n = NULL;
-	NODE *n = NULL;
-	long int i = 0;
+/* Least recently seen */
+int bckt_slot_oldest( SLOTS *s ) {
+	int i = 0, j = 0;
 
-	if( ( item_b = bckt_find_best_match( thislist, id )) == NULL ) {
-		return NULL;
+	for( i=1; i<s->count; i++ ) {
+		if( s->time_seen[i] < s->time_seen[j] ) {
+			j = i;
+		}
 	}
-	b = item_b->val;
-
-	list_n = b->nodes;
-	item_n = list_n->start;
-	for( i=0; i<list_n->counter; i++ ) {
-		n = item_n->val;
-		if( node_equal( n->id, id ) ) {
-			return item_n;
+
+	return j;
+}
+
+/* Most recently seen */
+int bckt_slot_newest( SLOTS *s ) {
+	int i = 0, j = 0;
+
+	for( i=1; i<s->count; i++ ) {
+		if( s->time_seen[i] > s->time_seen[j] ) {
+			j = i;
 		}
-		item_n = list_next( item_n );
 	}
 
-	return NULL;
+	return j;
 }
 
-int bckt_split( LIST *thislist, const UCHAR *id ) {
-	ITEM *item_b = NULL;
-	BUCK *b = NULL;
-	LIST *list_n = NULL;
-	ITEM *item_n = NULL;
-	NODE *n = NULL;
-	ITEM *item_s = NULL;
-	BUCK *s = NULL;
-	BUCK *b_new = NULL;
-	UCHAR id_new[SHA_DIGEST_LENGTH];
-	long int i = 0;
+/* Remember a node for the next free slot. The oldest candidate goes first. */
+void bckt_replace( NBHD *nbhd, BUCK *b, const UCHAR *id, IP *sa, unsigned int seen ) {
+	SLOTS *r = &b->replacements;
+	int i = 0;
 
-	/* Search bucket we want to evolve */
-	if( ( item_b = bckt_find_best_match( thislist, id )) == NULL ) {
-		return 0;
+	if( (i = bckt_slot_find( r, id )) >= 0 ) {
+		/* A node we only heard of again tells us nothing new */
+		if( seen == 0 ) {
+			return;
+		}
+	} else if( r->count < BCKT_K ) {
+		i = r->count++;
+	} else {
+		i = bckt_slot_oldest( r );
 	}
-	b = item_b->val;
 
-	/* Split whenever there are more than 8 nodes within a bucket */
-	if( b->nodes->counter <= 8 ) {
-		return 0;
+	bckt_slot_init( nbhd, r, i, id, sa, seen );
+}
+
+/* Move the most recently seen candidates into free slots */
+void bckt_refill( BUCK *b ) {
+	while( b->nodes.count < BCKT_K && b->replacements.count > 0 ) {
+		bckt_slot_move( &b->replacements, bckt_slot_newest( &b->replacements ), &b->nodes );
+	}
+}
+
+/* O(1): The shared prefix length is the bucket number */
+int bckt_index( NBHD *nbhd, const UCHAR *id ) {
+	int prefix = id_prefix( id, _main->conf->node_id );
+
+	return (prefix < nbhd->depth) ? prefix : nbhd->depth;
+}
+
+/* A random id that falls into the bucket with the given index */
+void bckt_random_id( NBHD *nbhd, int index, UCHAR *id ) {
+	const UCHAR *me = _main->conf->node_id;
+	int bytes = index / 8;
+	UCHAR mask = 0xFF << (8 - index % 8);
+	UCHAR bit = 0x80 >> (index % 8);
+
+	rand_urandom( id, SHA_DIGEST_LENGTH );
+
+	/* Share the first index bits with our own id */
+	memcpy( id, me, bytes );
+	if( bytes < SHA_DIGEST_LENGTH ) {
+		id[bytes] = (me[bytes] & mask) | (id[bytes] & ~mask);
+	}
+
+	/* ...and differ in the next one. The last bucket takes the rest. */
+	if( index < nbhd->depth ) {
+		id[bytes] = (id[bytes] & ~bit) | (~me[bytes] & bit);
 	}
+}
 
-	/* Compute id of the new bucket */
-	if( bckt_compute_id( thislist, item_b, id_new ) < 0 ) {
+int bckt_find_node( NBHD *nbhd, const UCHAR *id, NODE *n ) {
+	SLOTS *s = &nbhd->buckets[bckt_index( nbhd, id )].nodes;
+	int i = 0;
+
+	if( (i = bckt_slot_find( s, id )) < 0 ) {
 		return 0;
 	}
 
-	/* Create new bucket */
-	b_new = (BUCK *) myalloc( sizeof(BUCK), "split_bucket" );
-	memcpy( b_new->id, id_new, SHA_DIGEST_LENGTH );
-	b_new->nodes = list_init();
+	n->s = s;
+	n->i = i;
+
+	return 1;
+}
 
-	/* Insert new bucket */
-	list_ins( thislist, item_b, b_new );
+/* Hand the nodes that share more than depth bits on to a new bucket */
+void bckt_split( NBHD *nbhd ) {
+	BUCK *b = &nbhd->buckets[nbhd->depth];
+	BUCK *s = &nbhd->buckets[nbhd->depth + 1];
 
-	/* Remember nodes */
-	list_n = b->nodes;
+	bckt_split_slots( &b->nodes, &s->nodes, nbhd->depth );
+	bckt_split_slots( &b->replacements, &s->replacements, nbhd->depth );
 
-	/* Create new node list */
-	b->nodes = list_init();
+	nbhd->depth++;
+	s->time_touched = b->time_touched;
 
-	/* Walk through the existing nodes and find an adequate bucket */
-	item_n = list_n->start;
-	for( i=0; i<list_n->counter; i++ ) {
-		n = item_n->val;
-		item_s = bckt_find_best_match( thislist, n->id );
+	bckt_refill( b );
+	bckt_refill( s );
+}
 
-		s = item_s->val;
-		list_put( s->nodes, n );
+void bckt_split_slots( SLOTS *from, SLOTS *to, int depth ) {
+	int i = 0;
 
-		item_n = list_next( item_n );
+	/* Walk backwards: Deleting a slot moves the last one into the gap */
+	for( i=from->count-1; i>=0; i-- ) {
+		if( id_prefix( from->id[i], _main->conf->node_id ) > depth ) {
+			bckt_slot_move( from, i, to );
+		}
 	}
+}
 
-	/* Delete the old list but not its payload */
-	list_free( list_n );
+int bckt_find_addr( NBHD *nbhd, IP *sa, NODE *n ) {
+	UCHAR addr[BCKT_ADDRLEN];
+	SLOTS *s = NULL;
+	int k = 0;
+
+	memcpy( addr, &sa->sin6_addr, 16 );
+	memcpy( addr + 16, &sa->sin6_port, 2 );
+
+	for( k=0; k<=nbhd->depth; k++ ) {
+		s = &nbhd->buckets[k].nodes;
+		for( n->i=0; n->i<s->count; n->i++ ) {
+			if( memcmp( s->addr[n->i], addr, BCKT_ADDRLEN ) == 0 ) {
+				n->s = s;
+				return 1;
+			}
+		}
+	}
 
-	/* Bucket successfully split */
-	return 1;
+	return 0;
 }
 
-int bckt_compute_id( LIST *thislist, ITEM *item_b, UCHAR *id_return ) {
-	BUCK *b = item_b->val;
-	ITEM *item_next = NULL;
-	BUCK *b_next = NULL;
-	int bit1 = 0;
-	int bit2 = 0;
-	int bit = 0;
+/* Smoothed like TCP does: 7/8 of the old value and 1/8 of the new sample */
+void bckt_answered( NODE *n, long int rtt ) {
+	unsigned short *srtt = &n->s->rtt[n->i];
 
-	/* Is there a container next to this one? */
-	if( item_b != thislist->stop ) {
-		item_next = list_next( item_b );
-		b_next = item_next->val;
+	if( rtt < 1 ) {
+		rtt = 1;
+	} else if( rtt > 65535 ) {
+		rtt = 65535;
 	}
 
-	bit1 = bckt_significant_bit( b->id );
-	bit2 = (b_next != NULL) ? bckt_significant_bit( b_next->id ) : -1;
-	bit = (bit1 >= bit2) ? bit1 : bit2; bit++;
+	*srtt = ( *srtt == 0 ) ? rtt : ( 7 * (long int)*srtt + rtt ) / 8;
+	n->s->loss[n->i] -= n->s->loss[n->i] / 8;
+}
+
+void bckt_lost( NODE *n ) {
+	n->s->loss[n->i] = n->s->loss[n->i] - n->s->loss[n->i] / 8 + 31;
+}
 
-	if( bit >= (SHA_DIGEST_LENGTH * 8) ) {
-		return -1;
+/*
+ * Like bckt_find_closest(), but trade some XOR distance for latency and
+ * reliability: Out of the 2 * max closest nodes take the max nodes with the
+ * lowest cost. The cost is the distance rank plus a penalty for a high
+ * round trip time and for lost requests.
+ */
+long int bckt_find_best( NBHD *nbhd, const UCHAR *id, NODE *nodes, long int max, int verified ) {
+	NODE candidates[4 * BCKT_K];
+	long int cost[4 * BCKT_K];
+	long int size = 0;
+	long int c = 0;
+	long int i = 0, j = 0;
+	NODE n;
+
+	if( max > 2 * BCKT_K ) {
+		max = 2 * BCKT_K;
 	}
 
-	memcpy( id_return, b->id, SHA_DIGEST_LENGTH );
-	id_return[bit / 8] |= (0x80 >> (bit % 8));
+	size = bckt_find_closest( nbhd, id, candidates, 2 * max, verified );
 
-	return 1;
+	/* Insertion sort by cost, stable for equal costs */
+	for( i=0; i<size; i++ ) {
+		n = candidates[i];
+		c = i + n.s->rtt[n.i] / BCKT_RTT_STEP + n.s->loss[n.i] / BCKT_LOSS_STEP;
+
+		for( j=i; j>0 && cost[j - 1] > c; j-- ) {
+			candidates[j] = candidates[j - 1];
+			cost[j] = cost[j - 1];
+		}
+		candidates[j] = n;
+		cost[j] = c;
+	}
+
+	if( size > max ) {
+		size = max;
+	}
+	memcpy( nodes, candidates, size * sizeof(NODE) );
+
+	return size;
 }
 
-int bckt_significant_bit( const UCHAR *id ) {
-	int i=0, j=0;
+/* Keep the max nodes closest to id: The heap root is the farthest one */
+void bckt_heap_down( NODE *heap, long int size, long int i, const UCHAR *id ) {
+	NODE n;
+	long int c = 0;
 
-	for( i = SHA_DIGEST_LENGTH - 1; i >= 0; i-- ) {
-		if( id[i] != 0 ) {
+	while( (c = 2 * i + 1) < size ) {
+		if( c + 1 < size && id_compare( heap[c + 1].s->id[heap[c + 1].i], heap[c].s->id[heap[c].i], id ) > 0 ) {
+			c++;
+		}
+		if( id_compare( heap[c].s->id[heap[c].i], heap[i].s->id[heap[i].i], id ) <= 0 ) {
 			break;
 		}
+		n = heap[i];
+		heap[i] = heap[c];
+		heap[c] = n;
+		i = c;
 	}
+}
 
-	if( i < 0 ) {
-		return -1;
+void bckt_heap_put( NODE *heap, long int *size, long int max, NODE *n, const UCHAR *id ) {
+	NODE swap;
+	long int i = 0;
+	long int p = 0;
+
+	/* Heap is full: Replace the farthest node if n is closer */
+	if( *size >= max ) {
+		if( id_compare( n->s->id[n->i], heap[0].s->id[heap[0].i], id ) < 0 ) {
+			heap[0] = *n;
+			bckt_heap_down( heap, *size, 0, id );
+		}
+		return;
 	}
 
-	for( j = 7; j >= 0; j-- ) {
-		if( (id[i] &( 0x80 >> j)) != 0 ) {
+	/* Sift up */
+	i = (*size)++;
+	heap[i] = *n;
+	while( i > 0 ) {
+		p = (i - 1) / 2;
+		if( id_compare( heap[i].s->id[heap[i].i], heap[p].s->id[heap[p].i], id ) <= 0 ) {
 			break;
 		}
+		swap = heap[i];
+		heap[i] = heap[p];
+		heap[p] = swap;
+		i = p;
 	}
-
-	return 8 * i + j;
 }
 
-int node_me( UCHAR *node_id ) {
-	if( node_equal( node_id, _main->conf->node_id ) ) {
-		return 1;
+void bckt_heap_scan( SLOTS *s, NODE *heap, long int *size, long int max, const UCHAR *id, int verified ) {
+	NODE n = { s, 0 };
+
+	for( n.i=0; n.i<s->count; n.i++ ) {
+		/* Do not include nodes, that are questionable */
+		if( !verified || s->pinged[n.i] == 0 ) {
+			bckt_heap_put( heap, size, max, &n, id );
+		}
 	}
-	return 0;
 }
 
-int node_equal( const UCHAR *node_a, const UCHAR *node_b ) {
-	if( memcmp( node_a, node_b, SHA_DIGEST_LENGTH ) == 0 ) {
-		return 1;
+/*
+ * Fill nodes with up to max nodes closest to id, sorted by XOR distance.
+ *
+ * The bucket of id holds the closest nodes. All deeper buckets follow as one
+ * group: They are not ordered among each other by distance to id, so every
+ * one of them is scanned and the heap keeps the closest. The shallower
+ * buckets come last, each one strictly farther away than the one before,
+ * so the search stops there as soon as max nodes are known.
+ */
+long int bckt_find_closest( NBHD *nbhd, const UCHAR *id, NODE *nodes, long int max, int verified ) {
+	int index = bckt_index( nbhd, id );
+	long int size = 0;
+	NODE n;
+	int i = 0;
+
+	if( max <= 0 ) {
+		return 0;
 	}
-	return 0;
+
+	bckt_heap_scan( &nbhd->buckets[index].nodes, nodes, &size, max, id, verified );
+
+	if( size < max ) {
+		for( i=index+1; i<=nbhd->depth; i++ ) {
+			bckt_heap_scan( &nbhd->buckets[i].nodes, nodes, &size, max, id, verified );
+		}
+	}
+
+	for( i=index-1; i>=0 && size < max; i-- ) {
+		bckt_heap_scan( &nbhd->buckets[i].nodes, nodes, &size, max, id, verified );
+	}
+
+	/* Heap sort: Closest node first */
+	for( i=size-1; i>0; i-- ) {
+		n = nodes[0];
+		nodes[0] = nodes[i];
+		nodes[i] = n;
+		bckt_heap_down( nodes, i, 0, id );
+	}
+
+	return size;
 }
@@ -23,36 +23,109 @@ struct obj_nodes {
 };
 typedef struct obj_nodes NODES;
 
-struct obj_node {
-	IP c_addr;
+/* One bucket per length of the prefix shared with our own node id */
+#define BCKT_COUNT (SHA_DIGEST_LENGTH * 8 + 1)
+#define BCKT_K 8
+#define BCKT_STALE 2
+#define BCKT_ALL 0
+#define BCKT_VERIFIED 1
+
+/* Refresh buckets that saw no traffic for 15 minutes */
+#define BCKT_REFRESH 900
+
+/* Next hops: One rank of XOR distance is worth this much RTT in ms or loss */
+#define BCKT_RTT_STEP 50
+#define BCKT_LOSS_STEP 32
 
-	UCHAR id[SHA_DIGEST_LENGTH];
+/* IPv6 address and port as they are sent over the wire */
+#define BCKT_ADDRLEN 18
+
+/*
+ * Nodes are stored column by column, so scans over ids or timers stream
+ * through memory. Timestamps are seconds since nbhd->epoch. A time_seen of
+ * 0 means that the node has never contacted us directly.
+ */
+struct obj_neighborhood_slots {
+	UCHAR id[BCKT_K][SHA_DIGEST_LENGTH];
+	UCHAR addr[BCKT_K][BCKT_ADDRLEN];
+	unsigned int time_seen[BCKT_K];
+	unsigned int time_ping[BCKT_K];
+	UCHAR pinged[BCKT_K];
 
-	time_t time_ping;
-	time_t time_find;
-	int pinged;
+	/* Smoothed round trip time in ms (0: unknown) and loss rate (0-255) */
+	unsigned short rtt[BCKT_K];
+	UCHAR loss[BCKT_K];
+	int count;
+};
+typedef struct obj_neighborhood_slots SLOTS;
+
+/* A slot within the routing table */
+struct obj_node {
+	SLOTS *s;
+	int i;
 };
 typedef struct obj_node NODE;
 
 struct obj_neighborhood_bucket {
-	UCHAR id[SHA_DIGEST_LENGTH];
-	LIST *nodes;
+	SLOTS nodes;
+	SLOTS replacements;
+
+	/* Last time one of its nodes contacted us or we searched it */
+	unsigned int time_touched;
 };
 typedef struct obj_neighborhood_bucket BUCK;
 
-LIST *bckt_init( void );
-void bckt_free( LIST *thislist );
-void bckt_put( LIST *l, NODE *n );
-void bckt_del( LIST *l, NODE *n );
+struct obj_neighborhood {
+	BUCK buckets[BCKT_COUNT];
+
+	/* The last bucket in use holds every node sharing depth or more bits */
+	int depth;
+
+	time_t epoch;
+
+	/* Nodes dropped for not answering */
+	long int expired;
+};
+typedef struct obj_neighborhood NBHD;
+
+NBHD *bckt_init( void );
+void bckt_free( NBHD *nbhd );
+
+int bckt_put( NBHD *nbhd, const UCHAR *id, IP *sa, int direct, NODE *lru );
+void bckt_del( NBHD *nbhd, NODE *n );
+int bckt_contested( NBHD *nbhd, NODE *n );
+long int bckt_expire( NBHD *nbhd, int pinged );
+void bckt_touch( NBHD *nbhd, NODE *n, IP *sa );
+
+unsigned int bckt_time( NBHD *nbhd, time_t t );
+void bckt_addr_get( NODE *n, IP *sa );
+void bckt_addr_set( NODE *n, IP *sa );
+
+void bckt_slot_init( NBHD *nbhd, SLOTS *s, int i, const UCHAR *id, IP *sa, unsigned int seen );
+int bckt_slot_find( SLOTS *s, const UCHAR *id );
+void bckt_slot_copy( SLOTS *from, int i, SLOTS *to, int j );
+void bckt_slot_del( SLOTS *s, int i );
+void bckt_slot_move( SLOTS *from, int i, SLOTS *to );
+int bckt_slot_stale( SLOTS *s );
+int bckt_slot_oldest( SLOTS *s );
+int bckt_slot_newest( SLOTS *s );
+
+void bckt_replace( NBHD *nbhd, BUCK *b, const UCHAR *id, IP *sa, unsigned int seen );
+void bckt_refill( BUCK *b );
 
-ITEM *bckt_find_best_match( LIST *thislist, const UCHAR *id );
-ITEM *bckt_find_any_match( LIST *thislist, const UCHAR *id );
-ITEM *bckt_find_node( LIST *thislist, const UCHAR *id );
+int bckt_index( NBHD *nbhd, const UCHAR *id );
+void bckt_random_id( NBHD *nbhd, int index, UCHAR *id );
+int bckt_find_node( NBHD *nbhd, const UCHAR *id, NODE *n );
+long int bckt_find_closest( NBHD *nbhd, const UCHAR *id, NODE *nodes, long int max, int verified );
+long int bckt_find_best( NBHD *nbhd, const UCHAR *id, NODE *nodes, long int max, int verified );
+int bckt_find_addr( NBHD *nbhd, IP *sa, NODE *n );
 
-int bckt_split( LIST *thislist, const UCHAR *id );
+void bckt_answered( NODE *n, long int rtt );
+void bckt_lost( NODE *n );
 
-int bckt_compute_id( LIST *thislist, ITEM *item_b, UCHAR *id_return );
-int bckt_significant_bit( const UCHAR *id );
+void bckt_heap_down( NODE *heap, long int size, long int i, const UCHAR *id );
+void bckt_heap_put( NODE *heap, long int *size, long int max, NODE *n, const UCHAR *id );
+void bckt_heap_scan( SLOTS *s, NODE *heap, long int *size, long int max, const UCHAR *id, int verified );
 
-int node_me( UCHAR *node_id );
-int node_equal( const UCHAR *node_a, const UCHAR *node_b );
+void bckt_split( NBHD *nbhd );
+void bckt_split_slots( SLOTS *from, SLOTS *to, int depth );
@@ -56,6 +56,8 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 #include "time.h"
 #include "send_p2p.h"
 
+static POOL cache_pool = POOL_INIT( sizeof(struct obj_key), "cache" );
+
 struct obj_cache *cache_init( void ) {
 	struct obj_cache *cache = (struct obj_cache *) myalloc( sizeof(struct obj_cache), "cache_init" );
 	cache->list = list_init();
@@ -64,33 +66,46 @@ struct obj_cache *cache_init( void ) {
 }
 
 void cache_free( void ) {
-	list_clear( _main->cache->list );
+	ITEM *i = NULL;
+
+	i = _main->cache->list->start;
+	while( i ) {
+		pool_free( &cache_pool, i->val, "cache_free" );
+		i = list_next( i );
+	}
+
 	list_free( _main->cache->list );
 	hash_free( _main->cache->hash );
 	myfree( _main->cache, "cache_free" );
 }
 
-void cache_put( UCHAR *session_id, int type ) {
+struct obj_key *cache_put( UCHAR *session_id, int type, IP *sa ) {
 	ITEM *item_sk = NULL;
 	struct obj_key *sk = NULL;
 
 	if( hash_exists( _main->cache->hash, session_id, SHA_DIGEST_LENGTH) ) {
-		return;
+		return NULL;
 	}
 
-	sk = (struct obj_key *) myalloc( sizeof(struct obj_key), "cache_put" );
+	sk = (struct obj_key *) pool_alloc( &cache_pool, POOL_DIRTY, "cache_put" );
 
 	/* Session id */
 	memcpy( sk->session_id, session_id, SHA_DIGEST_LENGTH );
 
-	/* Multicast or Unicast */
+	/* Multicast, Unicast or Query */
 	sk->type = type;
 
 	/* Availability */
 	sk->time = time_add_1_min();
 
+	/* Round trip time */
+	memcpy( &sk->c_addr, sa, sizeof(IP) );
+	sk->time_sent = time_now_msec();
+
 	item_sk = list_put( _main->cache->list, sk );
 	hash_put( _main->cache->hash, sk->session_id, SHA_DIGEST_LENGTH, item_sk );
+
+	return sk;
 }
 
 void cache_del( UCHAR *session_id ) {
@@ -102,30 +117,42 @@ void cache_del( UCHAR *session_id ) {
 	}
 	sk = item_sk->val;
 
+	if( sk->type == CACHE_QUERY ) {
+		_main->cache->queries--;
+	}
+
 	hash_del( _main->cache->hash, session_id, SHA_DIGEST_LENGTH );
 	list_del( _main->cache->list, item_sk );
-	myfree( sk, "cache_del" );
+	pool_free( &cache_pool, sk, "cache_del" );
 }
 
 void cache_expire( void ) {
 	ITEM *item_sk = NULL;
 	ITEM *next_sk = NULL;
 	struct obj_key *sk = NULL;
+	time_t now = time_now_sec();
 
 	item_sk = _main->cache->list->start;
 	while( item_sk ) {
 		sk = item_sk->val;
 		next_sk = list_next( item_sk );
 
-		/* Bad cache */
-		if( _main->p2p->time_now.tv_sec > sk->time ) {
-			cache_del( sk->session_id );
+		/* Sessions are kept in the order they expire */
+		if( now <= sk->time ) {
+			break;
+		}
+
+		/* No answer */
+		if( sk->type == SEND_UNICAST ) {
+			nbhd_lost( &sk->c_addr );
 		}
+		cache_del( sk->session_id );
+
 		item_sk = next_sk;
 	}
 }
 
-int cache_validate( UCHAR *session_id ) {
+int cache_validate( UCHAR *session_id, UCHAR *node_id ) {
 	ITEM *item_sk = NULL;
 	struct obj_key *sk = NULL;
 
@@ -135,6 +162,11 @@ int cache_validate( UCHAR *session_id ) {
 	}
 	sk = item_sk->val;
 
+	/* A query of somebody else is no session of ours */
+	if( sk->type == CACHE_QUERY ) {
+		return 0;
+	}
+
 	/* Unicast: 
 	 *  Delete session id
 	 *
@@ -143,8 +175,51 @@ int cache_validate( UCHAR *session_id ) {
 	 *  The session id will timeout later...
 	 */
 	if( sk->type == SEND_UNICAST ) {
+		nbhd_answered( node_id, time_now_msec() - sk->time_sent );
+		p2p_loss( FALSE );
 		cache_del( session_id );
 	}
 
 	return 1;
 }
+
+/* Remember that a remote lookup asked us. Its result may be stored here later. */
+void cache_query( UCHAR *lkp_id, UCHAR *find_id, IP *sa ) {
+	struct obj_key *sk = NULL;
+
+	if( _main->cache->queries >= CACHE_QUERIES_MAX ) {
+		return;
+	}
+
+	if( ( sk = cache_put( lkp_id, CACHE_QUERY, sa ) ) == NULL ) {
+		return;
+	}
+	memcpy( sk->find_id, find_id, SHA_DIGEST_LENGTH );
+	_main->cache->queries++;
+}
+
+/* Accept a STORE only from the node that asked us for the same target */
+int cache_stored( UCHAR *lkp_id, UCHAR *find_id, IP *sa ) {
+	ITEM *item_sk = NULL;
+	struct obj_key *sk = NULL;
+
+	if( ( item_sk = hash_get( _main->cache->hash, lkp_id, SHA_DIGEST_LENGTH)) == NULL ) {
+		return 0;
+	}
+	sk = item_sk->val;
+
+	if( sk->type != CACHE_QUERY ) {
+		return 0;
+	}
+	if( memcmp( sk->find_id, find_id, SHA_DIGEST_LENGTH ) != 0 ) {
+		return 0;
+	}
+	if( memcmp( &sk->c_addr.sin6_addr, &sa->sin6_addr, 16 ) != 0 || sk->c_addr.sin6_port != sa->sin6_port ) {
+		return 0;
+	}
+
+	/* One STORE per lookup */
+	cache_del( lkp_id );
+
+	return 1;
+}
@@ -17,22 +17,37 @@ You should have received a copy of the GNU General Public License
 along with masala.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+/* Lookup of a remote node we answered with closer nodes */
+#define CACHE_QUERY 2
+#define CACHE_QUERIES_MAX 1000
+
 struct obj_cache {
 	LIST *list;
 	HASH *hash;
+	long int queries;
 };
 
 struct obj_key {
 	UCHAR session_id[SHA_DIGEST_LENGTH];
 	time_t time;
 	int type;
+
+	/* Unicast: Where and when the request went */
+	IP c_addr;
+	long long int time_sent;
+
+	/* Query: The target the remote node looked for */
+	UCHAR find_id[SHA_DIGEST_LENGTH];
 };
 
 struct obj_cache *cache_init( void );
 void cache_free( void );
 
-void cache_put( UCHAR *session_id, int type );
+struct obj_key *cache_put( UCHAR *session_id, int type, IP *sa );
 void cache_del( UCHAR *session_id );
 
+void cache_query( UCHAR *lkp_id, UCHAR *find_id, IP *sa );
+int cache_stored( UCHAR *lkp_id, UCHAR *find_id, IP *sa );
+
 void cache_expire( void );
-int cache_validate( UCHAR *session_id );
+int cache_validate( UCHAR *session_id, UCHAR *node_id );
@@ -29,6 +29,7 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 #include "str.h"
 #include "malloc.h"
 #include "list.h"
+#include "hash.h"
 #include "log.h"
 #include "file.h"
 #include "conf.h"
@@ -36,30 +37,37 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 #include "random.h"
 #include "ben.h"
 #include "p2p.h"
+#include "bucket.h"
 
 struct obj_conf *conf_init( void ) {
 	struct obj_conf *conf = (struct obj_conf *) myalloc( sizeof(struct obj_conf), "conf_init" );
 
 	conf->mode = CONF_FOREGROUND;
-	conf->port = strdup( CONF_PORT );
+	conf->port = mystrdup( CONF_PORT, "conf_init" );
 
 	rand_urandom( conf->node_id, SHA_DIGEST_LENGTH );
 	memset( conf->null_id, '\0', SHA_DIGEST_LENGTH );
 
 	conf->cores = (unix_cpus() > 2) ? unix_cpus() : CONF_CORES;
 	conf->quiet = CONF_VERBOSE;
-	conf->user = strdup( CONF_USER );
+	conf->user = mystrdup( CONF_USER, "conf_init" );
 
-	conf->bootstrap_node = strdup( CONF_BOOTSTRAP_NODE );
-	conf->bootstrap_port = strdup( CONF_BOOTSTRAP_PORT );
+	conf->bootstrap_node = mystrdup( CONF_BOOTSTRAP_NODE, "conf_init" );
+	conf->bootstrap_port = mystrdup( CONF_BOOTSTRAP_PORT, "conf_init" );
+
+	conf->negative_ttl = CONF_NEGATIVE_TTL;
+	conf->lookup_deadline = CONF_LOOKUP_DEADLINE;
+	conf->lookup_packets = CONF_LOOKUP_PACKETS;
+	conf->lookup_max = CONF_LOOKUP_MAX;
+	conf->lookup_quorum = CONF_LOOKUP_QUORUM;
 
 #ifdef DNS
-	conf->dns_port = strdup( CONF_DNS_PORT );
-	conf->dns_addr = strdup( CONF_DNS_ADDR );
+	conf->dns_port = mystrdup( CONF_DNS_PORT, "conf_init" );
+	conf->dns_addr = mystrdup( CONF_DNS_ADDR, "conf_init" );
 #endif
 #ifdef WEB
-	conf->web_port = strdup( CONF_WEB_PORT );
-	conf->web_addr = strdup( CONF_WEB_ADDR );
+	conf->web_port = mystrdup( CONF_WEB_PORT, "conf_init" );
+	conf->web_addr = mystrdup( CONF_WEB_ADDR, "conf_init" );
 #endif
 
 	return conf;
@@ -69,6 +77,7 @@ void conf_free( void ) {
 	if( _main->conf != NULL ) {
 		myfree( _main->conf->user, "conf_free" );
 		myfree( _main->conf->pid_file, "conf_free" );
+		myfree( _main->conf->nodes_file, "conf_free" );
 		myfree( _main->conf->hostname, "conf_free" );
 		myfree( _main->conf->bootstrap_node, "conf_free" );
 		myfree( _main->conf->bootstrap_port, "conf_free" );
@@ -101,6 +110,66 @@ void conf_check( void ) {
 	log_info( "Bootstrap Node: %s (-ba)", _main->conf->bootstrap_node );
 	log_info( "Bootstrap Port: UDP/%s (-bp)", _main->conf->bootstrap_port );
 
+	if( _main->conf->nodes_file ) {
+		log_info( "Nodes file: %s (-nf)", _main->conf->nodes_file );
+	} else {
+		log_info( "Nodes file: <none> (-nf)" );
+	}
+
+	log_info( "Negative TTL: %i seconds (-nt)", _main->conf->negative_ttl );
+	if( _main->conf->negative_ttl < 0 || _main->conf->negative_ttl > 3600 ) {
+		log_err( "Invalid negative TTL. Use 0 to 3600 seconds. (-nt)" );
+	}
+
+	log_info( "Lookup deadline: %i ms (-ld)", _main->conf->lookup_deadline );
+	if( _main->conf->lookup_deadline < 100 || _main->conf->lookup_deadline > 60000 ) {
+		log_err( "Invalid lookup deadline. Use 100 to 60000 ms. (-ld)" );
+	}
+
+	log_info( "Lookup packets: %i (-lp)", _main->conf->lookup_packets );
+	if( _main->conf->lookup_packets < 1 ) {
+		log_err( "Invalid number of packets per lookup. (-lp)" );
+	}
+
+	log_info( "Concurrent lookups: %i (-lm)", _main->conf->lookup_max );
+	if( _main->conf->lookup_max < 1 ) {
+		log_err( "Invalid number of concurrent lookups. (-lm)" );
+	}
+
+	log_info( "Lookup quorum: %i (-lq)", _main->conf->lookup_quorum );
+	if( _main->conf->lookup_quorum < 1 || _main->conf->lookup_quorum > BCKT_K ) {
+		log_err( "Invalid lookup quorum. Use 1 to %i. (-lq)", BCKT_K );
+	}
+
+	/* Interfaces without an own quorum use the lookup quorum */
+#ifdef DNS
+	if( _main->conf->dns_quorum == 0 ) {
+		_main->conf->dns_quorum = _main->conf->lookup_quorum;
+	}
+	log_info( "DNS quorum: %i (-dq)", _main->conf->dns_quorum );
+	if( _main->conf->dns_quorum < 1 || _main->conf->dns_quorum > BCKT_K ) {
+		log_err( "Invalid DNS quorum. Use 1 to %i. (-dq)", BCKT_K );
+	}
+#endif
+#ifdef WEB
+	if( _main->conf->web_quorum == 0 ) {
+		_main->conf->web_quorum = _main->conf->lookup_quorum;
+	}
+	log_info( "WEB quorum: %i (-wq)", _main->conf->web_quorum );
+	if( _main->conf->web_quorum < 1 || _main->conf->web_quorum > BCKT_K ) {
+		log_err( "Invalid WEB quorum. Use 1 to %i. (-wq)", BCKT_K );
+	}
+#endif
+#ifdef NSS
+	if( _main->conf->nss_quorum == 0 ) {
+		_main->conf->nss_quorum = _main->conf->lookup_quorum;
+	}
+	log_info( "NSS quorum: %i (-nq)", _main->conf->nss_quorum );
+	if( _main->conf->nss_quorum < 1 || _main->conf->nss_quorum > BCKT_K ) {
+		log_err( "Invalid NSS quorum. Use 1 to %i. (-nq)", BCKT_K );
+	}
+#endif
+
 	if( _main->conf->mode == CONF_FOREGROUND ) {
 		log_info( "Mode: Foreground (-d)" );
 	} else {
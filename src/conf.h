@@ -39,11 +39,17 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 #define CONF_WEB_PORT "8080"
 #define CONF_CMD_ADDR "::1"
 #define CONF_CMD_PORT "4374"
+#define CONF_NEGATIVE_TTL 30
+#define CONF_LOOKUP_DEADLINE 5000
+#define CONF_LOOKUP_PACKETS 32
+#define CONF_LOOKUP_MAX 64
+#define CONF_LOOKUP_QUORUM 1
 
 struct obj_conf {
 	char *user;
 
 	char *pid_file;
+	char *nodes_file;
 	char *hostname;
 	UCHAR node_id[SHA_DIGEST_LENGTH];
 	UCHAR host_id[SHA_DIGEST_LENGTH];
@@ -51,15 +57,35 @@ struct obj_conf {
 	char *bootstrap_node;
 	char *bootstrap_port;
 
+	/* Seconds to remember names that could not be resolved */
+	int negative_ttl;
+
+	/* Milliseconds a lookup may take */
+	int lookup_deadline;
+
+	/* Requests a lookup may send */
+	int lookup_packets;
+
+	/* Lookups in flight. As many again may wait. */
+	int lookup_max;
+
+	/* Nodes that must return the same address. 1 answers with the first one. */
+	int lookup_quorum;
+
 #ifdef DNS
 	char *dns_port;
 	char *dns_addr;
 	char *dns_ifce;
+	int dns_quorum;
 #endif
 #ifdef WEB
 	char *web_port;
 	char *web_addr;
 	char *web_ifce;
+	int web_quorum;
+#endif
+#ifdef NSS
+	int nss_quorum;
 #endif
 
 	/* Number of cores */
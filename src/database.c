@@ -48,6 +48,7 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 #include "search.h"
 #include "time.h"
 
+static POOL db_pool = POOL_INIT( sizeof(DB), "db" );
 
 struct obj_database *db_init( void ) {
 	struct obj_database *database = (struct obj_database *) myalloc( sizeof(struct obj_database), "db_init" );
@@ -57,7 +58,13 @@ struct obj_database *db_init( void ) {
 }
 
 void db_free( void ) {
-	list_clear( _main->database->list );
+	ITEM *i = NULL;
+
+	i = _main->database->list->start;
+	while( i ) {
+		pool_free( &db_pool, i->val, "db_free" );
+		i = list_next( i );
+	}
 	list_free( _main->database->list );
 	hash_free(  _main->database->hash );
 	myfree( _main->database, "db_free" );
@@ -70,8 +77,9 @@ void db_put( UCHAR *host_id, IP *sa ) {
 	/* Create new storage place holder if necessary */
 	if ( (i = db_find( host_id )) == NULL ) {
 
-		db = (DB *) myalloc( sizeof(DB), "db_put" );
+		db = (DB *) pool_alloc( &db_pool, POOL_DIRTY, "db_put" );
 		memcpy( db->host_id, host_id, SHA_DIGEST_LENGTH );
+		db->cached = FALSE;
 		db_update( db, sa);
 
 		i = list_put( _main->database->list, db );
@@ -87,15 +95,55 @@ void db_put( UCHAR *host_id, IP *sa ) {
 }
 
 void db_update( DB *db, IP *sa ) {
+	if( db->cached ) {
+		_main->database->cached--;
+	}
 	db->time_anno = time_add_15_min();
+	db->cached = FALSE;
+	memcpy( &db->c_addr, sa, sizeof(IP) );
+}
+
+/*
+ * Anybody may send a STORE. Cached copies live for one announce interval,
+ * never replace an announcement or an earlier copy and are only served to
+ * remote lookups, where they are one vote among others.
+ */
+void db_cache( UCHAR *host_id, IP *sa ) {
+	ITEM *i = NULL;
+	DB *db = NULL;
+
+	if( ( i = db_find( host_id ) ) != NULL ) {
+		db = i->val;
+
+		/* Announced to us: Keep that */
+		if( !db->cached ) {
+			return;
+		}
+	} else {
+		/* Full: Leave the room to announcements */
+		if( _main->database->cached >= DB_CACHED_MAX ) {
+			return;
+		}
+		db_put( host_id, sa );
+		i = db_find( host_id );
+		db = i->val;
+		_main->database->cached++;
+	}
+
+	/* A later copy replaces an older one */
 	memcpy( &db->c_addr, sa, sizeof(IP) );
+	db->time_anno = time_now_sec() + TIME_5_MINUTES;
+	db->cached = TRUE;
 }
 
 void db_del( ITEM *i ) {
 	DB *db = i->val;
+	if( db->cached ) {
+		_main->database->cached--;
+	}
 	hash_del( _main->database->hash, db->host_id, SHA_DIGEST_LENGTH );
 	list_del( _main->database->list, i );
-	myfree( db, "db_del" );
+	pool_free( &db_pool, db, "db_del" );
 }
 
 void db_expire( void ) {
@@ -103,6 +151,7 @@ void db_expire( void ) {
 	ITEM *n = NULL;
 	DB *db = NULL;
 	long int j=0;
+	time_t now = time_now_sec();
 
 	i = _main->database->list->start;
 	for( j=0; j<_main->database->list->counter; j++ ) {
@@ -110,7 +159,7 @@ void db_expire( void ) {
 		n = list_next(i);
 
 		/* Delete node after 15 minutes without announcement. */
-		if( _main->p2p->time_now.tv_sec > db->time_anno ) {
+		if( now > db->time_anno ) {
 			db_del( i );
 
 			log_info( "Database size: %li (-1)",
@@ -146,6 +195,7 @@ int db_send( IP *from, UCHAR *host_id, UCHAR *lkp_id, UCHAR *session_id ) {
 	return 1;
 }
 
+/* Local resolution trusts announcements only, not copies from a lookup path */
 IP *db_address( UCHAR *host_id ) {
 	ITEM *i = NULL;
 	DB *db = NULL;
@@ -155,6 +205,10 @@ IP *db_address( UCHAR *host_id ) {
 	}
 	db = i->val;
 
+	if( db->cached ) {
+		return NULL;
+	}
+
 	/* Reply the stored IP address. */
 	return &db->c_addr;
 }
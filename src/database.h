@@ -17,15 +17,23 @@ You should have received a copy of the GNU General Public License
 along with masala.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#define DB_CACHED_MAX 1000
+
 struct obj_database {
 	LIST *list;
 	HASH *hash;
+
+	/* Copies from lookup paths */
+	long int cached;
 };
 
 struct obj_database_node {
 	UCHAR host_id[SHA_DIGEST_LENGTH];
 	IP c_addr;
 	time_t time_anno;
+
+	/* Copy from a lookup path, not announced to us */
+	int cached;
 };
 typedef struct obj_database_node DB;
 
@@ -33,6 +41,7 @@ struct obj_database *db_init(void);
 void db_free(void);
 
 void db_put(UCHAR *host_id, IP *sa);
+void db_cache(UCHAR *host_id, IP *sa);
 void db_del(ITEM *item_st);
 
 void db_expire(void);
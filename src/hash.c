@@ -43,7 +43,7 @@ void hash_free( HASH *map ) {
 
 	bucket = map->buckets;
 	for( i=0; i<map->count; i++ ) {
-		myfree( bucket->pairs, "hash_free" );
+		slab_free( bucket->pairs, bucket->count * sizeof(PAIR), "hash_free" );
 		bucket++;
 	}
 
@@ -88,6 +88,7 @@ int hash_put( HASH *map, UCHAR *key, long int keysize, void *value ) {
 	unsigned int index = 0;
 	BUCKET *bucket = NULL;
 	PAIR *pair = NULL;
+	PAIR *pairs = NULL;
 
 	if( map == NULL || key == NULL || value == NULL ) {
 		return 0;
@@ -103,13 +104,13 @@ int hash_put( HASH *map, UCHAR *key, long int keysize, void *value ) {
 	}
 
 	/* Create new obj_pair */
-	if( bucket->count == 0 ) {
-		bucket->pairs = myalloc( sizeof(PAIR), "hash_put" );
-		bucket->count = 1;
-	} else  {
-		bucket->pairs = myrealloc( bucket->pairs,( bucket->count + 1) * sizeof(PAIR), "hash_put" );
-		bucket->count++;
+	pairs = slab_alloc( (bucket->count + 1) * sizeof(PAIR), POOL_DIRTY, "hash_put" );
+	if( bucket->count > 0 ) {
+		memcpy( pairs, bucket->pairs, bucket->count * sizeof(PAIR) );
+		slab_free( bucket->pairs, bucket->count * sizeof(PAIR), "hash_put" );
 	}
+	bucket->pairs = pairs;
+	bucket->count++;
 	
 	/* Store key pairs */
 	pair = &(bucket->pairs[bucket->count - 1] );
@@ -144,13 +145,13 @@ void hash_del( HASH *map, UCHAR *key, long int keysize ) {
 	}
 	
 	if( bucket->count == 1 ) {
-		myfree( bucket->pairs, "hash_rem" );
+		slab_free( bucket->pairs, sizeof(PAIR), "hash_rem" );
 		bucket->pairs = NULL;
 		bucket->count = 0;
 	} else if( bucket->count > 1 ) {
 		/* Get new memory and remember the old one */
 		oldpair = bucket->pairs;
-		newpair = myalloc( (bucket->count - 1) * sizeof(PAIR), "hash_rem" );
+		newpair = slab_alloc( (bucket->count - 1) * sizeof(PAIR), POOL_DIRTY, "hash_rem" );
 
 		/* Copy pairs except the one to delete */
 		p_old = oldpair;
@@ -163,7 +164,7 @@ void hash_del( HASH *map, UCHAR *key, long int keysize ) {
 			p_old++;
 		}
 
-		myfree( oldpair, "hash_rem" );
+		slab_free( oldpair, bucket->count * sizeof(PAIR), "hash_rem" );
 		bucket->pairs = newpair;
 		bucket->count--;
 	}
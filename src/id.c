@@ -0,0 +1,121 @@
+/*
+Copyright 2011 Aiko Barz
+
+This file is part of masala.
+
+masala is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+masala is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with masala.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <endian.h>
+#include <signal.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "malloc.h"
+#include "main.h"
+#include "conf.h"
+#include "id.h"
+
+/*
+ * The ids are plain byte arrays inside packets, nodes and hashes. They are
+ * loaded with memcpy() which compiles down to unaligned word loads. Byte
+ * order only matters for the distance, so bytes get swapped there alone.
+ */
+
+int id_equal( const UCHAR *id_a, const UCHAR *id_b ) {
+#ifdef __SSE2__
+	__m128i a = _mm_loadu_si128( (const __m128i *)id_a );
+	__m128i b = _mm_loadu_si128( (const __m128i *)id_b );
+	uint32_t c = 0, d = 0;
+
+	if( _mm_movemask_epi8( _mm_cmpeq_epi8( a, b ) ) != 0xFFFF ) {
+		return 0;
+	}
+#else
+	uint64_t a = 0, b = 0;
+	uint32_t c = 0, d = 0;
+	int i = 0;
+
+	for( i=0; i<ID_WORDS; i++ ) {
+		memcpy( &a, id_a + 8 * i, 8 );
+		memcpy( &b, id_b + 8 * i, 8 );
+		if( a != b ) {
+			return 0;
+		}
+	}
+#endif
+
+	memcpy( &c, id_a + 16, 4 );
+	memcpy( &d, id_b + 16, 4 );
+
+	return c == d;
+}
+
+int id_me( const UCHAR *id ) {
+	return id_equal( id, _main->conf->node_id );
+}
+
+/* <0: id_a is closer to id than id_b, >0: id_b is closer, 0: equal */
+int id_compare( const UCHAR *id_a, const UCHAR *id_b, const UCHAR *id ) {
+	uint64_t a = 0, b = 0, t = 0;
+	uint32_t c = 0, d = 0, u = 0;
+	int i = 0;
+
+	for( i=0; i<ID_WORDS; i++ ) {
+		memcpy( &a, id_a + 8 * i, 8 );
+		memcpy( &b, id_b + 8 * i, 8 );
+		if( a != b ) {
+			memcpy( &t, id + 8 * i, 8 );
+			return ( be64toh( a ^ t ) < be64toh( b ^ t ) ) ? -1 : 1;
+		}
+	}
+
+	memcpy( &c, id_a + 16, 4 );
+	memcpy( &d, id_b + 16, 4 );
+	if( c != d ) {
+		memcpy( &u, id + 16, 4 );
+		return ( be32toh( c ^ u ) < be32toh( d ^ u ) ) ? -1 : 1;
+	}
+
+	return 0;
+}
+
+/* Number of leading bits both ids have in common */
+int id_prefix( const UCHAR *id_a, const UCHAR *id_b ) {
+	uint64_t a = 0, b = 0;
+	uint32_t c = 0, d = 0;
+	int i = 0;
+
+	for( i=0; i<ID_WORDS; i++ ) {
+		memcpy( &a, id_a + 8 * i, 8 );
+		memcpy( &b, id_b + 8 * i, 8 );
+		if( a != b ) {
+			return 64 * i + __builtin_clzll( be64toh( a ^ b ) );
+		}
+	}
+
+	memcpy( &c, id_a + 16, 4 );
+	memcpy( &d, id_b + 16, 4 );
+	if( c != d ) {
+		return 128 + __builtin_clz( be32toh( c ^ d ) );
+	}
+
+	return SHA_DIGEST_LENGTH * 8;
+}
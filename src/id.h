@@ -0,0 +1,26 @@
+/*
+Copyright 2011 Aiko Barz
+
+This file is part of masala.
+
+masala is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+masala is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with masala.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Node ids are compared as two 64-bit words and one 32-bit word */
+#define ID_WORDS 2
+
+int id_equal( const UCHAR *id_a, const UCHAR *id_b );
+int id_me( const UCHAR *id );
+int id_compare( const UCHAR *id_a, const UCHAR *id_b, const UCHAR *id );
+int id_prefix( const UCHAR *id_a, const UCHAR *id_b );
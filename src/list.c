@@ -30,6 +30,8 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 #include "malloc.h"
 #include "list.h"
 
+static POOL list_pool = POOL_INIT( sizeof(ITEM), "list" );
+
 LIST *list_init( void ) {
 	LIST *list = (LIST *) myalloc( sizeof(LIST), "list_init" );
 
@@ -69,7 +71,7 @@ ITEM *list_put( LIST *list, void *payload ) {
 	}
 
 	/* Get memory */
-	newItem = (ITEM *) myalloc( sizeof(ITEM), "list_put" );
+	newItem = (ITEM *) pool_alloc( &list_pool, POOL_DIRTY, "list_put" );
 
 	/* Data container */
 	newItem->val = payload;
@@ -110,7 +112,7 @@ ITEM *list_ins( LIST *list, ITEM *here, void *payload ) {
 	}
 
 	/* Data */
-	new = (ITEM *) myalloc( sizeof(ITEM), "list_ins" );
+	new = (ITEM *) pool_alloc( &list_pool, POOL_DIRTY, "list_ins" );
 	new->val = payload;
 
 	/* Setup pointer */
@@ -163,7 +165,7 @@ ITEM *list_del( LIST *list, ITEM *item ) {
 	list->counter--;
 
 	/* item is not linked anymore. Free it */
-	myfree( item, "list_del" );
+	pool_free( &list_pool, item, "list_del" );
 
 	return next;
 }
@@ -202,3 +204,24 @@ void list_swap( LIST *list, ITEM *item1, ITEM *item2 ) {
 		list->stop = item1;
 	}
 }
+
+/* Move item to the end of the list. The item itself stays valid. */
+void list_tail( LIST *list, ITEM *item ) {
+	if( list->stop == item ) {
+		return;
+	}
+
+	/* Unlink */
+	if( item->prev == NULL ) {
+		list->start = item->next;
+	} else {
+		item->prev->next = item->next;
+	}
+	item->next->prev = item->prev;
+
+	/* Append */
+	item->prev = list->stop;
+	item->next = NULL;
+	list->stop->next = item;
+	list->stop = item;
+}
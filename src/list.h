@@ -42,3 +42,4 @@ ITEM *list_del( LIST *list, ITEM *item );
 ITEM *list_next( ITEM *item );
 ITEM *list_prev( ITEM *item );
 void list_swap( LIST *list, ITEM *item1, ITEM *item2 );
+void list_tail( LIST *list, ITEM *item );
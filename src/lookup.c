@@ -52,14 +52,17 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 #include "lookup.h"
 #include "announce.h"
 #include "bucket.h"
+#include "id.h"
 #include "neighborhood.h"
 #include "send_p2p.h"
 #include "random.h"
+#include "resolver.h"
 
 LOOKUPS *lkp_init( void ) {
 	LOOKUPS *lookups = (LOOKUPS *) myalloc( sizeof(LOOKUPS), "lkp_init" );
 	lookups->list = list_init();
 	lookups->hash = hash_init( 4096 );
+	lookups->find = hash_init( 4096 );
 	return lookups;
 }
 
@@ -67,16 +70,32 @@ void lkp_free( void ) {
 	list_clear( _main->lkps->list );
 	list_free( _main->lkps->list );
 	hash_free( _main->lkps->hash );
+	hash_free( _main->lkps->find );
 	myfree( _main->lkps, "lkp_free" );
 }
 
-LOOKUP *lkp_put( UCHAR *find_id, CALLBACK *callback, void *ctx ) {
+/* Find the address of find_id within deadline ms. Answer when quorum nodes agree. */
+LOOKUP *lkp_put( UCHAR *find_id, long int deadline, int quorum, CALLBACK *callback, void *ctx ) {
 	ITEM *i = NULL;
 	LOOKUP *l = NULL;
 
+	/* Somebody is already searching for it: Wait for the same result */
+	if( ( i = hash_get( _main->lkps->find, find_id, SHA_DIGEST_LENGTH ) ) != NULL ) {
+		l = i->val;
+		lkp_wait( l, deadline, quorum, callback, ctx );
+		lkp_notify( l );
+		return l;
+	}
+
+	/* Too many lookups running and waiting: Fail fast */
+	if( _main->lkps->list->counter >= 2 * _main->conf->lookup_max ) {
+		_main->lkps->rejected++;
+		return NULL;
+	}
+
 	l = (LOOKUP *) myalloc( sizeof(LOOKUP), "lkp_put" );
 
-	/* Remember nodes that have been asked */
+	/* Remember nodes that have been seen */
 	l->list = list_init();
 	l->hash = hash_init( 100 );
 
@@ -87,61 +106,378 @@ LOOKUP *lkp_put( UCHAR *find_id, CALLBACK *callback, void *ctx ) {
 	rand_urandom( l->lkp_id, SHA_DIGEST_LENGTH );
 
 	/* Callback on success */
-	l->callback = callback;
-	l->ctx = ctx;
-
-	/* Expire after at least 5 seconds  */
-	l->time_find = time_add_x_sec( 5 );
+	l->waiters = list_init();
+	l->time_deadline = 0;
+	l->quorum = 0;
+	lkp_wait( l, deadline, quorum, callback, ctx );
+
+	/* Empty shortlist */
+	l->size = 0;
+	l->values_size = 0;
+	l->messages = 0;
+	l->hops = 0;
+	l->time_start = time_now_msec();
+	l->time_answer = 0;
 
 	/* Remember lookup request */
 	i = list_put( _main->lkps->list, l );
 	hash_put( _main->lkps->hash, l->lkp_id, SHA_DIGEST_LENGTH, i );
+	hash_put( _main->lkps->find, l->find_id, SHA_DIGEST_LENGTH, i );
 
-	/* Search the requested name */
-	nbhd_lookup( l );
+	/* Wait for a free slot */
+	if( _main->lkps->active >= _main->conf->lookup_max ) {
+		l->queued = TRUE;
+		_main->lkps->queued++;
+		return l;
+	}
+
+	lkp_start( l );
 
 	return l;
 }
 
+void lkp_start( LOOKUP *l ) {
+	l->queued = FALSE;
+	_main->lkps->active++;
+
+	/* Fill the shortlist with the closest nodes we know */
+	nbhd_lookup( l );
+
+	/* Search the requested name */
+	lkp_step( l );
+}
+
+void lkp_wait( LOOKUP *l, long int deadline, int quorum, CALLBACK *callback, void *ctx ) {
+	struct obj_lookup_waiter *w = NULL;
+	long long int time_deadline = time_now_msec() + deadline;
+
+	/* The most patient caller decides */
+	if( time_deadline > l->time_deadline ) {
+		l->time_deadline = time_deadline;
+	}
+
+	if( quorum < 1 ) {
+		quorum = 1;
+	}
+	if( quorum > l->quorum ) {
+		l->quorum = quorum;
+	}
+
+	if( callback == NULL ) {
+		return;
+	}
+
+	w = (struct obj_lookup_waiter *) myalloc( sizeof(struct obj_lookup_waiter), "lkp_wait" );
+	w->callback = callback;
+	w->ctx = ctx;
+	w->quorum = quorum;
+	w->time_deadline = time_deadline;
+	list_put( l->waiters, w );
+}
+
 void lkp_del( ITEM *i ) {
 	LOOKUP *l = i->val;
 
+	if( !l->queued ) {
+		_main->lkps->active--;
+	}
+
 	/* Free lookup cache */
 	list_clear( l->list );
 	list_free( l->list );
 	hash_free( l->hash );
+	list_clear( l->waiters );
+	list_free( l->waiters );
 
 	/* Delete lookup item */
 	hash_del( _main->lkps->hash, l->lkp_id, SHA_DIGEST_LENGTH );
+	hash_del( _main->lkps->find, l->find_id, SHA_DIGEST_LENGTH );
 	list_del( _main->lkps->list, i );
 	myfree( l, "lkp_del" );
 }
 
+/*
+ * The lookup has converged or ran out of time: Cache the address most nodes
+ * agree on, account for the cost and delete the lookup. Without the quorum
+ * of the strictest caller nothing is cached. Waiters that did not get their
+ * quorum fail.
+ */
+void lkp_finish( ITEM *i ) {
+	LOOKUP *l = i->val;
+	struct obj_lookup_value *v = lkp_best( l );
+	struct obj_lookup_waiter *w = NULL;
+	ITEM *item = NULL;
+	long int msec = time_now_msec() - l->time_start;
+	int votes = v ? v->votes : 0;
+	int missing = FALSE;
+	char hexbuf[HEX_LEN+1];
+
+	if( votes < l->quorum ) {
+		v = NULL;
+	}
+
+	/* Names nobody knows and lookups that never ran say nothing about the network */
+	if( l->values_size > 0 ) {
+		p2p_observe( l->time_answer );
+	}
+
+	_main->lkps->count++;
+	_main->lkps->messages += l->messages;
+	if( v ) {
+		lkp_store( l, v->address );
+		rslv_found( l->find_id, v->address );
+		_main->lkps->success++;
+		_main->lkps->hops += l->hops;
+		_main->lkps->msec += l->time_answer;
+		if( l->values_size > 1 ) {
+			_main->lkps->disagreed++;
+		}
+	} else if( l->messages > 0 && l->values_size == 0 ) {
+		/* Only a network that was asked and knows no address proves the name missing.
+		 * Addresses short of the quorum are no proof either way. */
+		missing = TRUE;
+		rslv_failed( l->find_id );
+	}
+
+	log_info( "LOOKUP %s %s after %li ms, %i messages, %i hops, %i votes, %i addresses, %li waiting",
+		id_str( l->find_id, hexbuf ), v ? "answered" : "failed", msec, l->messages, l->hops,
+		votes, l->values_size, l->waiters->counter );
+
+	/* A timeout reports no address */
+	item = l->waiters->start;
+	while( item ) {
+		w = item->val;
+		w->callback( w->ctx, l->find_id, NULL, missing );
+		item = list_next( item );
+	}
+
+	lkp_del( i );
+
+	/* Start the next waiting lookup, if a slot became free */
+	if( _main->lkps->active >= _main->conf->lookup_max ) {
+		return;
+	}
+	for( item = _main->lkps->list->start; item; item = list_next( item ) ) {
+		l = item->val;
+		if( l->queued ) {
+			lkp_start( l );
+			break;
+		}
+	}
+}
+
+/* Answer everybody whose quorum is reached. The lookup goes on to fill the cache. */
+void lkp_notify( LOOKUP *l ) {
+	struct obj_lookup_value *v = lkp_best( l );
+	struct obj_lookup_waiter *w = NULL;
+	ITEM *item = NULL;
+	ITEM *next = NULL;
+
+	if( v == NULL ) {
+		return;
+	}
+
+	item = l->waiters->start;
+	while( item ) {
+		w = item->val;
+		next = list_next( item );
+		if( v->votes >= w->quorum ) {
+			w->callback( w->ctx, l->find_id, v->address, FALSE );
+			myfree( w, "lkp_notify" );
+			list_del( l->waiters, item );
+		}
+		item = next;
+	}
+}
+
+/* The address with the most votes. The first one wins a tie. */
+struct obj_lookup_value *lkp_best( LOOKUP *l ) {
+	struct obj_lookup_value *v = NULL;
+	int j = 0;
+
+	for( j=0; j<l->values_size; j++ ) {
+		if( v == NULL || l->values[j].votes > v->votes ) {
+			v = &l->values[j];
+		}
+	}
+
+	return v;
+}
+
 void lkp_expire( void ) {
 	ITEM *item = NULL;
 	ITEM *next = NULL;
 	LOOKUP *l = NULL;
+	long long int now = time_now_msec();
+	int j = 0;
 
 	item = _main->lkps->list->start;
 	while( item ) {
 		l = item->val;
 		next = list_next( item );
 
-		if( _main->p2p->time_now.tv_sec > l->time_find ) {
+		/* Hedge: Silent nodes become suspect and the next ones are asked.
+		 * A late reply still counts. */
+		for( j=0; j<l->size; j++ ) {
+			if( l->nodes[j].state == LKP_SENT && now - l->nodes[j].time_sent > l->nodes[j].timeout ) {
+				l->nodes[j].state = LKP_SUSPECT;
+				p2p_loss( TRUE );
+			}
+		}
+		lkp_step( l );
+		lkp_timeout( l, now );
+
+		if( now > l->time_deadline || lkp_done( l ) ) {
+			lkp_finish( item );
+		}
+		item = next;
+	}
+}
 
-			/* Let the callback know the lookup timed out */
-			if(l->callback)
-				l->callback( l->ctx, l->find_id, NULL );
+/*
+ * Fail the waiters whose own deadline passed. The lookup goes on for the
+ * others. The most patient ones learn the result from lkp_finish().
+ */
+void lkp_timeout( LOOKUP *l, long long int now ) {
+	struct obj_lookup_waiter *w = NULL;
+	ITEM *item = NULL;
+	ITEM *next = NULL;
 
-			lkp_del( item );
+	item = l->waiters->start;
+	while( item ) {
+		w = item->val;
+		next = list_next( item );
+		if( now > w->time_deadline && w->time_deadline < l->time_deadline ) {
+			w->callback( w->ctx, l->find_id, NULL, FALSE );
+			myfree( w, "lkp_timeout" );
+			list_del( l->waiters, item );
 		}
 		item = next;
 	}
 }
 
-void lkp_resolve( UCHAR *lkp_id, UCHAR *node_id, IP *c_addr ) {
+/* Insert a candidate sorted by distance. The farthest one drops out. */
+void lkp_insert( LOOKUP *l, UCHAR *node_id, IP *c_addr, int hops ) {
+	struct obj_lookup_node *n = NULL;
+	int j = 0;
+
+	/* Never ask myself and consider every node only once */
+	if( id_me( node_id ) || hash_exists( l->hash, node_id, SHA_DIGEST_LENGTH ) ) {
+		return;
+	}
+	lkp_remember( l, node_id );
+
+	for( j=l->size; j>0; j-- ) {
+		if( id_compare( l->nodes[j - 1].id, node_id, l->find_id ) < 0 ) {
+			break;
+		}
+	}
+
+	if( j >= LKP_SHORTLIST ) {
+		return;
+	}
+
+	if( l->size < LKP_SHORTLIST ) {
+		l->size++;
+	}
+	memmove( &l->nodes[j + 1], &l->nodes[j], ( l->size - j - 1 ) * sizeof(struct obj_lookup_node) );
+
+	n = &l->nodes[j];
+	memcpy( n->id, node_id, SHA_DIGEST_LENGTH );
+	memcpy( &n->c_addr, c_addr, sizeof(IP) );
+	n->state = LKP_NEW;
+	n->hops = hops;
+	n->time_sent = 0;
+	n->timeout = 0;
+}
+
+/* Keep up to alpha requests in flight to the closest unasked nodes */
+void lkp_step( LOOKUP *l ) {
+	struct obj_lookup_node *n = NULL;
+	int alpha = p2p_scale( LKP_ALPHA );
+	int inflight = 0;
+	int j = 0;
+
+	for( j=0; j<l->size; j++ ) {
+		if( l->nodes[j].state == LKP_SENT ) {
+			inflight++;
+		}
+	}
+
+	if( l->queued ) {
+		return;
+	}
+
+	for( j=0; j<l->size && inflight < alpha && l->messages < _main->conf->lookup_packets; j++ ) {
+		n = &l->nodes[j];
+		if( n->state != LKP_NEW ) {
+			continue;
+		}
+
+		p2p_charge( 1 );
+		send_lookup( &n->c_addr, l->find_id, l->lkp_id );
+		n->state = LKP_SENT;
+		n->time_sent = time_now_msec();
+		n->timeout = nbhd_timeout( n->id );
+		l->messages++;
+		inflight++;
+	}
+}
+
+/*
+ * Converged: The k closest nodes that are alive have all answered.
+ * Or out of budget: No more requests to send and none in flight.
+ */
+int lkp_done( LOOKUP *l ) {
+	int closest = 0;
+	int j = 0;
+
+	if( l->queued ) {
+		return 0;
+	}
+
+	if( l->messages >= _main->conf->lookup_packets ) {
+		for( j=0; j<l->size; j++ ) {
+			if( l->nodes[j].state == LKP_SENT ) {
+				return 0;
+			}
+		}
+		return 1;
+	}
+
+	for( j=0; j<l->size && closest<BCKT_K; j++ ) {
+		switch( l->nodes[j].state ) {
+			case LKP_SUSPECT:
+				break;
+			case LKP_DONE:
+			case LKP_VALUE:
+				closest++;
+				break;
+			default:
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+struct obj_lookup_node *lkp_node( LOOKUP *l, UCHAR *node_id ) {
+	int j = 0;
+
+	for( j=0; j<l->size; j++ ) {
+		if( id_equal( l->nodes[j].id, node_id ) ) {
+			return &l->nodes[j];
+		}
+	}
+
+	return NULL;
+}
+
+/* from_id told us about node_id */
+void lkp_resolve( UCHAR *lkp_id, UCHAR *from_id, UCHAR *node_id, IP *c_addr ) {
 	ITEM *i = NULL;
 	LOOKUP *l = NULL;
+	struct obj_lookup_node *n = NULL;
 
 	/* Lookup the lookup ID */
 	if( ( i = hash_get( _main->lkps->hash, lkp_id, SHA_DIGEST_LENGTH ) ) == NULL ) {
@@ -149,23 +485,42 @@ void lkp_resolve( UCHAR *lkp_id, UCHAR *node_id, IP *c_addr ) {
 	}
 	l = i->val;
 
-	/* Ask every node only once */
-	if( hash_exists( l->hash, node_id, SHA_DIGEST_LENGTH ) ) {
+	n = lkp_node( l, from_id );
+	lkp_insert( l, node_id, c_addr, n ? n->hops + 1 : 1 );
+}
+
+/* node_id replied with nodes: Ask the next ones or stop */
+void lkp_answered( UCHAR *lkp_id, UCHAR *node_id ) {
+	ITEM *i = NULL;
+	LOOKUP *l = NULL;
+	struct obj_lookup_node *n = NULL;
+
+	/* Lookup the lookup ID */
+	if( ( i = hash_get( _main->lkps->hash, lkp_id, SHA_DIGEST_LENGTH ) ) == NULL ) {
 		return;
 	}
+	l = i->val;
 
-	/* Ask the node just once */
-	if( !node_me( node_id ) ) {
-		send_lookup( c_addr, l->find_id, lkp_id );
+	if( ( n = lkp_node( l, node_id ) ) != NULL ) {
+		n->state = LKP_DONE;
 	}
 
-	/* Remember that node */
-	lkp_remember( l, node_id );
+	lkp_step( l );
+
+	if( lkp_done( l ) ) {
+		lkp_finish( i );
+	}
 }
 
+/*
+ * node_id replied with an address. Do not trust the first answer: Count it
+ * as one vote, answer the waiters whose quorum is reached and keep asking
+ * the closest nodes until the lookup converges.
+ */
 void lkp_success( UCHAR *lkp_id, UCHAR *node_id, UCHAR *address ) {
 	ITEM *i = NULL;
 	LOOKUP *l = NULL;
+	struct obj_lookup_node *n = NULL;
 
 	/* Lookup the lookup ID */
 	if( ( i = hash_get( _main->lkps->hash, lkp_id, SHA_DIGEST_LENGTH ) ) == NULL ) {
@@ -173,11 +528,58 @@ void lkp_success( UCHAR *lkp_id, UCHAR *node_id, UCHAR *address ) {
 	}
 	l = i->val;
 
-	if( l->callback )
-		l->callback( l->ctx, node_id, address );
+	/* Only nodes we asked vote and only once */
+	if( ( n = lkp_node( l, node_id ) ) == NULL || n->state == LKP_VALUE ) {
+		return;
+	}
+	n->state = LKP_VALUE;
 
-	/* Done */
-	lkp_del( i );
+	if( l->values_size == 0 ) {
+		l->hops = n->hops;
+		l->time_answer = time_now_msec() - l->time_start;
+	}
+	lkp_vote( l, address );
+	lkp_notify( l );
+
+	lkp_step( l );
+
+	if( lkp_done( l ) ) {
+		lkp_finish( i );
+	}
+}
+
+void lkp_vote( LOOKUP *l, UCHAR *address ) {
+	struct obj_lookup_value *v = NULL;
+	int j = 0;
+
+	for( j=0; j<l->values_size; j++ ) {
+		if( memcmp( l->values[j].address, address, 16 ) == 0 ) {
+			l->values[j].votes++;
+			return;
+		}
+	}
+
+	/* Too many different answers: Ignore the rest */
+	if( l->values_size >= LKP_VALUES ) {
+		return;
+	}
+
+	v = &l->values[l->values_size++];
+	memcpy( v->address, address, 16 );
+	v->votes = 1;
+}
+
+/* Copy the value to the closest node that did not have it */
+void lkp_store( LOOKUP *l, UCHAR *address ) {
+	int j = 0;
+
+	for( j=0; j<l->size; j++ ) {
+		if( l->nodes[j].state == LKP_DONE ) {
+			p2p_charge( 1 );
+			send_store( &l->nodes[j].c_addr, l->find_id, l->lkp_id, address );
+			return;
+		}
+	}
 }
 
 void lkp_remember( LOOKUP *l, UCHAR *node_id ) {
@@ -17,14 +17,68 @@ You should have received a copy of the GNU General Public License
 along with masala.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-typedef void (CALLBACK)( void *ctx, UCHAR *node_id, UCHAR *address );
+/* Requests in flight per lookup */
+#define LKP_ALPHA 3
+
+/* Candidates per lookup, sorted by distance to the searched id */
+#define LKP_SHORTLIST 32
+
+/* Different addresses collected per lookup */
+#define LKP_VALUES 8
+
+#define LKP_NEW 0
+#define LKP_SENT 1
+#define LKP_DONE 2
+#define LKP_SUSPECT 3
+#define LKP_VALUE 4
+
+/* Without an address, missing tells whether the network was asked and does not know the name */
+typedef void (CALLBACK)( void *ctx, UCHAR *node_id, UCHAR *address, int missing );
 
 struct obj_lookups {
 	LIST *list;
 	HASH *hash;
+
+	/* Lookups in flight by searched id */
+	HASH *find;
+
+	/* Running lookups. The others wait in the list. */
+	int active;
+
+	/* Statistics of finished lookups */
+	long int count;
+	long int success;
+	long int messages;
+	long int hops;
+	long int msec;
+	long int queued;
+	long int rejected;
+	long int disagreed;
 };
 typedef struct obj_lookups LOOKUPS;
 
+struct obj_lookup_node {
+	UCHAR id[SHA_DIGEST_LENGTH];
+	IP c_addr;
+	int state;
+	int hops;
+	long long int time_sent;
+	long int timeout;
+};
+
+/* quorum 1 returns the first value. m waits for m nodes to agree. */
+struct obj_lookup_waiter {
+	CALLBACK *callback;
+	void *ctx;
+	int quorum;
+	long long int time_deadline;
+};
+
+struct obj_lookup_value {
+	UCHAR address[16];
+	int votes;
+};
+
 struct obj_lookup {
 	LIST *list;
 	HASH *hash;
@@ -32,21 +86,56 @@ struct obj_lookup {
 	UCHAR find_id[SHA_DIGEST_LENGTH+1];
 	UCHAR lkp_id[SHA_DIGEST_LENGTH+1];
 
-	CALLBACK *callback;
-	void *ctx;
+	/* Everybody waiting for the result */
+	LIST *waiters;
+
+	/* Give up at this time in ms. Every waiter may give up earlier. */
+	long long int time_deadline;
 
-	time_t time_find;
+	/* Waiting for a free slot */
+	int queued;
+
+	/* Votes needed before the result is cached. The strictest caller decides. */
+	int quorum;
+
+	/* Shortlist */
+	struct obj_lookup_node nodes[LKP_SHORTLIST];
+	int size;
+
+	/* Addresses returned by the nodes, one vote per node */
+	struct obj_lookup_value values[LKP_VALUES];
+	int values_size;
+
+	/* Statistics */
+	long long int time_start;
+	long int time_answer;
+	int messages;
+	int hops;
 };
 typedef struct obj_lookup LOOKUP;
 
 LOOKUPS *lkp_init( void );
 void lkp_free( void );
 
-LOOKUP *lkp_put( UCHAR *find_id, CALLBACK *callback, void *ctx );
+LOOKUP *lkp_put( UCHAR *find_id, long int deadline, int quorum, CALLBACK *callback, void *ctx );
+void lkp_wait( LOOKUP *l, long int deadline, int quorum, CALLBACK *callback, void *ctx );
+void lkp_start( LOOKUP *l );
 void lkp_del( ITEM *i );
+void lkp_finish( ITEM *i );
+void lkp_notify( LOOKUP *l );
+struct obj_lookup_value *lkp_best( LOOKUP *l );
 
 void lkp_expire( void );
+void lkp_timeout( LOOKUP *l, long long int now );
+
+void lkp_insert( LOOKUP *l, UCHAR *node_id, IP *c_addr, int hops );
+void lkp_step( LOOKUP *l );
+int lkp_done( LOOKUP *l );
+struct obj_lookup_node *lkp_node( LOOKUP *l, UCHAR *node_id );
 
-void lkp_resolve( UCHAR *lkp_id, UCHAR *node_id, IP *c_addr );
+void lkp_resolve( UCHAR *lkp_id, UCHAR *from_id, UCHAR *node_id, IP *c_addr );
+void lkp_answered( UCHAR *lkp_id, UCHAR *node_id );
 void lkp_success( UCHAR *lkp_id, UCHAR *node_id, UCHAR *address );
+void lkp_vote( LOOKUP *l, UCHAR *address );
+void lkp_store( LOOKUP *l, UCHAR *address );
 void lkp_remember( LOOKUP *l, UCHAR *node_id );
@@ -52,6 +52,7 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 #include "p2p.h"
 #include "cache.h"
 #include "database.h"
+#include "resolver.h"
 #include "log.h"
 #ifdef DNS
 #include "masala-dns.h"
@@ -103,6 +104,7 @@ int main( int argc, char **argv ) {
 	_main->lkps = lkp_init();
 	_main->announce = announce_init();
 	_main->database = db_init();
+	_main->resolver = rslv_init();
 	_main->cache = cache_init();
 	_main->p2p = p2p_init();
 	_main->udp = udp_init();
@@ -113,6 +115,9 @@ int main( int argc, char **argv ) {
 	/* Catch SIG INT */
 	unix_signal();
 
+	/* Restore node id and routing table */
+	nbhd_load();
+
 	/* Fork daemon */
 	unix_fork();
 
@@ -148,7 +153,11 @@ int main( int argc, char **argv ) {
 
 	udp_stop();
 
+	/* Keep the routing table for the next start */
+	nbhd_save();
+
 	/* free resources */
+	rslv_free();
 	db_free();
 	announce_free();
 	lkp_free();
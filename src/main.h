@@ -41,9 +41,10 @@ struct obj_main {
 	struct obj_udp *udp;
 	struct obj_p2p *p2p;
 	struct obj_cache *cache;
-	struct obj_list *nbhd;
+	struct obj_neighborhood *nbhd;
 	struct obj_lookups *lkps;
 	struct obj_database *database;
+	struct obj_resolver *resolver;
 	struct obj_announce *announce;
 
 	/* Thread terminater */
@@ -28,10 +28,176 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 #include <semaphore.h>
 #include <signal.h>
 
+#include "malloc.h"
 #include "main.h"
 #include "list.h"
 #include "log.h"
 
+#ifdef MEMSTATS
+/* Every block carries the tag of its allocation site */
+#define MEM_HEADER 16
+
+struct obj_memhead {
+	int tag;
+	long int size;
+};
+
+struct obj_memcount {
+	long int allocs;
+	long int frees;
+	long int bytes_alloc;
+	long int bytes_free;
+};
+
+static const char *mem_tags[MEMSTATS_TAGS];
+static int mem_tag_counter = 0;
+
+/* Caller string address => tag index */
+static const char *mem_slot_ptr[MEMSTATS_SLOTS];
+static int mem_slot_tag[MEMSTATS_SLOTS];
+static int mem_lock = 0;
+
+/* Counters are written by their own thread only */
+static struct obj_memcount *mem_threads[MEMSTATS_THREADS];
+static int mem_thread_counter = 0;
+static __thread struct obj_memcount *mem_counts = NULL;
+
+static void pool_lock( int *lock );
+static void pool_unlock( int *lock );
+
+static int mem_tag_register( const char *caller, unsigned long slot ) {
+	int tag = -1;
+	int i = 0;
+
+	pool_lock( &mem_lock );
+
+	/* Somebody else was faster */
+	while( mem_slot_ptr[slot] != NULL && mem_slot_ptr[slot] != caller ) {
+		slot = (slot + 1) % MEMSTATS_SLOTS;
+	}
+
+	if( mem_slot_ptr[slot] == NULL ) {
+		/* The same tag may live at different addresses */
+		for( i=0; i<mem_tag_counter; i++ ) {
+			if( strcmp( mem_tags[i], caller ) == 0 ) {
+				tag = i;
+				break;
+			}
+		}
+
+		if( tag < 0 && mem_tag_counter < MEMSTATS_TAGS - 1 ) {
+			tag = mem_tag_counter;
+			mem_tags[tag] = caller;
+			__atomic_store_n( &mem_tag_counter, tag + 1, __ATOMIC_RELEASE );
+		} else if( tag < 0 ) {
+			/* Out of tags: Share the last one */
+			tag = MEMSTATS_TAGS - 1;
+			mem_tags[tag] = "other";
+			__atomic_store_n( &mem_tag_counter, MEMSTATS_TAGS, __ATOMIC_RELEASE );
+		}
+
+		mem_slot_tag[slot] = tag;
+		__atomic_store_n( &mem_slot_ptr[slot], caller, __ATOMIC_RELEASE );
+	}
+
+	pool_unlock( &mem_lock );
+
+	return mem_slot_tag[slot];
+}
+
+static int mem_tag_find( const char *caller ) {
+	unsigned long slot = ((unsigned long) caller >> 3) % MEMSTATS_SLOTS;
+	const char *p = NULL;
+
+	while( (p = __atomic_load_n( &mem_slot_ptr[slot], __ATOMIC_ACQUIRE )) != NULL ) {
+		if( p == caller ) {
+			return mem_slot_tag[slot];
+		}
+		slot = (slot + 1) % MEMSTATS_SLOTS;
+	}
+
+	return mem_tag_register( caller, slot );
+}
+
+static struct obj_memcount *mem_thread( void ) {
+	if( mem_counts != NULL ) {
+		return mem_counts;
+	}
+
+	/* Never freed: The numbers survive their thread */
+	mem_counts = (struct obj_memcount *) calloc( MEMSTATS_TAGS, sizeof(struct obj_memcount) );
+	if( mem_counts == NULL ) {
+		log_crit( "calloc() failed. mem_thread" );
+	}
+
+	pool_lock( &mem_lock );
+	if( mem_thread_counter >= MEMSTATS_THREADS ) {
+		pool_unlock( &mem_lock );
+		log_crit( "Too many threads for memory statistics" );
+	}
+	mem_threads[mem_thread_counter] = mem_counts;
+	__atomic_store_n( &mem_thread_counter, mem_thread_counter + 1, __ATOMIC_RELEASE );
+	pool_unlock( &mem_lock );
+
+	return mem_counts;
+}
+
+static void *mem_tag( void *memory, long int size, const char *caller ) {
+	struct obj_memhead *head = (struct obj_memhead *) memory;
+	struct obj_memcount *c = NULL;
+
+	head->tag = mem_tag_find( caller );
+	head->size = size;
+
+	c = &mem_thread()[head->tag];
+	c->allocs++;
+	c->bytes_alloc += size;
+
+	return (char *) memory + MEM_HEADER;
+}
+
+static void *mem_untag( void *arg ) {
+	struct obj_memhead *head = (struct obj_memhead *) ((char *) arg - MEM_HEADER);
+	struct obj_memcount *c = NULL;
+
+	c = &mem_thread()[head->tag];
+	c->frees++;
+	c->bytes_free += head->size;
+
+	return head;
+}
+
+int mem_stats( struct obj_memstat *stats, int max ) {
+	struct obj_memcount *c = NULL;
+	int threads = __atomic_load_n( &mem_thread_counter, __ATOMIC_ACQUIRE );
+	int tags = __atomic_load_n( &mem_tag_counter, __ATOMIC_ACQUIRE );
+	int i = 0, j = 0;
+
+	tags = (tags < max) ? tags : max;
+	memset( stats, '\0', tags * sizeof(struct obj_memstat) );
+
+	for( i=0; i<tags; i++ ) {
+		stats[i].tag = mem_tags[i];
+	}
+
+	/* Sum up without locking: The counters only grow */
+	for( j=0; j<threads; j++ ) {
+		c = mem_threads[j];
+		for( i=0; i<tags; i++ ) {
+			stats[i].live += c[i].allocs - c[i].frees;
+			stats[i].bytes += c[i].bytes_alloc - c[i].bytes_free;
+			stats[i].allocs += c[i].allocs;
+		}
+	}
+
+	return tags;
+}
+#else
+#define MEM_HEADER 0
+#define mem_tag( memory, size, caller ) (memory)
+#define mem_untag( arg ) (arg)
+#endif
+
 void *myalloc( long int size, const char *caller ) {
 	void *memory = NULL;
 
@@ -41,12 +207,14 @@ void *myalloc( long int size, const char *caller ) {
 		log_crit( "Memfail in myalloc(): Negative size?!: %s", caller );
 	}
 
-	memory = (void *) malloc( size );
+	memory = (void *) malloc( size + MEM_HEADER );
 	
 	if( memory == NULL ) {
 		log_crit( "malloc() failed. %s", caller );
 	}
 
+	memory = mem_tag( memory, size, caller );
+
 	memset( memory, '\0', size );
 
 	/*
@@ -63,20 +231,252 @@ void *myrealloc( void *arg, long int size, const char *caller ) {
 		log_crit( "Memfail in myrealloc(): Negative size?!: %s", caller );
 	}
 
-	arg = (void *) realloc( arg, size );
+	if( arg != NULL ) {
+		arg = mem_untag( arg );
+	}
+
+	arg = (void *) realloc( arg, size + MEM_HEADER );
 	
 	if( arg == NULL ) {
 		log_crit( "realloc() failed. %s", caller );
 	}
 
-	return arg;
+	return mem_tag( arg, size, caller );
 }
 
 void myfree( void *arg, const char *caller ) {
 	if( arg != NULL ) {
-		free( arg );
+		free( mem_untag( arg ) );
 		/*
 		printf( "free( %s)\n", caller );
 		*/
 	}
 }
+
+char *mystrdup( const char *s, const char *caller ) {
+	size_t size = strlen( s ) + 1;
+	char *dup = (char *) myalloc( size, caller );
+
+	memcpy( dup, s, size );
+
+	return dup;
+}
+
+
+/* Per-thread free lists. Every pool owns one slot in each thread. */
+struct obj_pool_cache {
+	void *free;
+	int counter;
+};
+
+static __thread struct obj_pool_cache pool_cache[POOL_MAX];
+static POOL *pool_table[POOL_MAX];
+static int pool_counter = 0;
+static int pool_register_lock = 0;
+
+static POOL slab_class[SLAB_CLASSES] = {
+	POOL_INIT( 16, "slab" ), POOL_INIT( 32, "slab" ), POOL_INIT( 48, "slab" ), POOL_INIT( 64, "slab" ),
+	POOL_INIT( 80, "slab" ), POOL_INIT( 96, "slab" ), POOL_INIT( 112, "slab" ), POOL_INIT( 128, "slab" ),
+	POOL_INIT( 144, "slab" ), POOL_INIT( 160, "slab" ), POOL_INIT( 176, "slab" ), POOL_INIT( 192, "slab" ),
+	POOL_INIT( 208, "slab" ), POOL_INIT( 224, "slab" ), POOL_INIT( 240, "slab" ), POOL_INIT( 256, "slab" )
+};
+
+/* The global lists are only touched in batches, a spinlock is sufficient */
+static void pool_lock( int *lock ) {
+	while( __sync_lock_test_and_set( lock, 1 ) ) {
+		while( *(volatile int *)lock ) {
+			;
+		}
+	}
+}
+
+static void pool_unlock( int *lock ) {
+	__sync_lock_release( lock );
+}
+
+static void pool_register( POOL *pool ) {
+	pool_lock( &pool_register_lock );
+
+	if( pool->id < 0 ) {
+		if( pool_counter >= POOL_MAX ) {
+			log_crit( "Too many memory pools: %s", pool->name );
+		}
+
+		/* Room for the free list pointer, keep pointers aligned */
+		if( pool->size < (long int) sizeof(void *) ) {
+			pool->size = sizeof(void *);
+		}
+		pool->size = (pool->size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+		pool_table[pool_counter] = pool;
+		__atomic_store_n( &pool->id, pool_counter++, __ATOMIC_RELEASE );
+	}
+
+	pool_unlock( &pool_register_lock );
+}
+
+/* Objects per slab */
+static long int pool_slab_objects( POOL *pool ) {
+	long int stride = pool->size + MEM_HEADER;
+	return (POOL_SLAB >= stride) ? POOL_SLAB / stride : 1;
+}
+
+static void pool_refill( POOL *pool, struct obj_pool_cache *cache, const char *caller ) {
+	long int stride = pool->size + MEM_HEADER;
+	char *slab = NULL;
+	void *item = NULL;
+	long int i = 0;
+	long int n = 0;
+
+	pool_lock( &pool->lock );
+
+	/* Carve a new slab into objects */
+	if( pool->free == NULL ) {
+		n = pool_slab_objects( pool );
+		slab = (char *) malloc( n * stride );
+
+		if( slab == NULL ) {
+			pool_unlock( &pool->lock );
+			log_crit( "malloc() failed. %s", caller );
+		}
+
+		for( i=n-1; i>=0; i-- ) {
+			item = slab + i * stride;
+			*(void **)item = pool->free;
+			pool->free = item;
+		}
+		pool->slabs++;
+	}
+
+	/* Take half a cache */
+	while( pool->free != NULL && cache->counter < POOL_CACHE / 2 ) {
+		item = pool->free;
+		pool->free = *(void **)item;
+
+		*(void **)item = cache->free;
+		cache->free = item;
+		cache->counter++;
+	}
+
+	pool_unlock( &pool->lock );
+}
+
+static void pool_spill( POOL *pool, struct obj_pool_cache *cache ) {
+	void *first = cache->free;
+	void *last = cache->free;
+	int i = 0;
+
+	/* Detach half of the cache */
+	for( i=1; i<POOL_CACHE / 2; i++ ) {
+		last = *(void **)last;
+	}
+	cache->free = *(void **)last;
+	cache->counter -= POOL_CACHE / 2;
+
+	pool_lock( &pool->lock );
+	*(void **)last = pool->free;
+	pool->free = first;
+	pool_unlock( &pool->lock );
+}
+
+void *pool_alloc( POOL *pool, int zero, const char *caller ) {
+	struct obj_pool_cache *cache = NULL;
+	void *memory = NULL;
+	int id = __atomic_load_n( &pool->id, __ATOMIC_ACQUIRE );
+
+	if( id < 0 ) {
+		pool_register( pool );
+		id = pool->id;
+	}
+	cache = &pool_cache[id];
+
+	if( cache->free == NULL ) {
+		pool_refill( pool, cache, caller );
+	}
+
+	memory = cache->free;
+	cache->free = *(void **)memory;
+	cache->counter--;
+
+	memory = mem_tag( memory, pool->size, caller );
+
+	/* Objects that get initialized completely do not need this */
+	if( zero ) {
+		memset( memory, '\0', pool->size );
+	}
+
+	return memory;
+}
+
+void pool_free( POOL *pool, void *arg, const char *caller ) {
+	struct obj_pool_cache *cache = NULL;
+
+	if( arg == NULL ) {
+		return;
+	}
+	cache = &pool_cache[pool->id];
+	arg = mem_untag( arg );
+
+	*(void **)arg = cache->free;
+	cache->free = arg;
+	cache->counter++;
+
+	/* Give objects back, another thread may need them */
+	if( cache->counter >= POOL_CACHE ) {
+		pool_spill( pool, cache );
+	}
+}
+
+void *slab_alloc( long int size, int zero, const char *caller ) {
+	void *memory = NULL;
+
+	if( size <= 0 ) {
+		log_crit( "Memfail in slab_alloc(): Invalid size?!: %s", caller );
+	}
+
+	if( size <= SLAB_MAXSIZE ) {
+		return pool_alloc( &slab_class[(size - 1) / SLAB_ALIGN], zero, caller );
+	}
+
+	memory = (void *) malloc( size + MEM_HEADER );
+
+	if( memory == NULL ) {
+		log_crit( "malloc() failed. %s", caller );
+	}
+
+	memory = mem_tag( memory, size, caller );
+
+	if( zero ) {
+		memset( memory, '\0', size );
+	}
+
+	return memory;
+}
+
+/* The size must be the one given to slab_alloc() */
+void slab_free( void *arg, long int size, const char *caller ) {
+	if( arg == NULL ) {
+		return;
+	}
+
+	if( size <= SLAB_MAXSIZE ) {
+		pool_free( &slab_class[(size - 1) / SLAB_ALIGN], arg, caller );
+	} else {
+		free( mem_untag( arg ) );
+	}
+}
+
+/* Memory held by all pools, in use or not */
+long int pool_memory( void ) {
+	int pools = __atomic_load_n( &pool_counter, __ATOMIC_ACQUIRE );
+	long int bytes = 0;
+	POOL *pool = NULL;
+	int i = 0;
+
+	for( i=0; i<pools; i++ ) {
+		pool = pool_table[i];
+		bytes += pool->slabs * pool_slab_objects( pool ) * (pool->size + MEM_HEADER);
+	}
+
+	return bytes;
+}
@@ -17,6 +17,57 @@ You should have received a copy of the GNU General Public License
 along with masala.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+/* Objects a thread keeps for itself before it gives some back */
+#define POOL_CACHE 64
+#define POOL_MAX 32
+#define POOL_SLAB 65536
+
+/* Clear objects on allocation? */
+#define POOL_ZERO 1
+#define POOL_DIRTY 0
+
+/* Size classes: 16, 32, ..., 256 bytes */
+#define SLAB_ALIGN 16
+#define SLAB_CLASSES 16
+#define SLAB_MAXSIZE (SLAB_ALIGN * SLAB_CLASSES)
+
+struct obj_pool {
+	long int size;
+	const char *name;
+	int id;
+	int lock;
+	void *free;
+	long int slabs;
+};
+typedef struct obj_pool POOL;
+
+#define POOL_INIT( size, name ) { (size), (name), -1, 0, NULL, 0 }
+
+/* Per allocation site accounting (FEATURES += memstats) */
+#define MEMSTATS_TAGS 128
+#define MEMSTATS_SLOTS 1024
+#define MEMSTATS_THREADS 256
+
+struct obj_memstat {
+	const char *tag;
+	long int live;
+	long int bytes;
+	long int allocs;
+};
+
 void *myalloc( long int size, const char *caller );
 void *myrealloc( void *arg, long int size, const char *caller );
 void myfree( void *arg, const char *caller );
+char *mystrdup( const char *s, const char *caller );
+
+void *pool_alloc( POOL *pool, int zero, const char *caller );
+void pool_free( POOL *pool, void *arg, const char *caller );
+
+void *slab_alloc( long int size, int zero, const char *caller );
+void slab_free( void *arg, long int size, const char *caller );
+
+long int pool_memory( void );
+
+#ifdef MEMSTATS
+int mem_stats( struct obj_memstat *stats, int max );
+#endif
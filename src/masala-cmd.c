@@ -49,6 +49,7 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 #include "announce.h"
 #include "neighborhood.h"
 #include "database.h"
+#include "resolver.h"
 #include "time.h"
 #include "random.h"
 #include "masala-cmd.h"
@@ -59,9 +60,10 @@ const char* cmd_usage_str =
 "	status\n"
 "	ping <ip> [<port>]\n"
 "	lookup <key>\n"
-"	search <key>\n"
+"	search <key> [<quorum>]\n"
 "	print_database\n"
 "	print_nodes\n"
+"	memstats\n"
 "	shutdown\n"
 "\n";
 
@@ -158,38 +160,55 @@ void cmd_print_status( REPLY *r ) {
 	} else {
 		r_printf( r, "Own host id: <none>\n" );
 	}
+
+	if( _main->p2p->time_ready > 0 ) {
+		r_printf( r, "Routing table: %i nodes, ready after %li ms\n", nbhd_count(), _main->p2p->time_ready );
+	} else {
+		r_printf( r, "Routing table: %i nodes, joining\n", nbhd_count() );
+	}
+	r_printf( r, "Expired nodes: %li\n", _main->nbhd->expired );
+
+	r_printf( r, "Lookups: %i running, %li waiting, %li queued, %li rejected\n", _main->lkps->active,
+		_main->lkps->list->counter - _main->lkps->active, _main->lkps->queued, _main->lkps->rejected );
+	r_printf( r, "Finished lookups: %li, %li answered", _main->lkps->count, _main->lkps->success );
+	if( _main->lkps->count > 0 ) {
+		r_printf( r, ", %li messages per lookup", _main->lkps->messages / _main->lkps->count );
+	}
+	if( _main->lkps->success > 0 ) {
+		r_printf( r, ", %li hops, %li ms per answer, %li disagreed", _main->lkps->hops / _main->lkps->success, _main->lkps->msec / _main->lkps->success, _main->lkps->disagreed );
+	}
+	r_printf( r, "\n" );
+
+	r_printf( r, "Fan-out: %i%%, loss %li/1000\n", _main->p2p->gain, _main->p2p->loss );
+	r_printf( r, "Resolver cache: %li names, %li hits, %li negative hits, %li misses, %li prefetches\n", _main->resolver->list->counter,
+		_main->resolver->hits, _main->resolver->negative_hits, _main->resolver->misses, _main->resolver->prefetches );
 }
 
 void cmd_print_nodes( REPLY *r ) {
-	ITEM *item_b = NULL;
 	BUCK *b = NULL;
-	ITEM *item_n = NULL;
-	NODE *n = NULL;
+	NODE n;
+	IP addr;
 	char addrbuf[FULL_ADDSTRLEN+1];
 	char hexbuf[HEX_LEN+1];
+	int k = 0;
 
 	r_printf( r, "Known node id / address pairs from neighborhood:\n" );
 
 	/* Cycle through all the buckets */
-	item_b = _main->nbhd->start;
-	while( item_b ) {
-		b = item_b->val;
+	for( k=0; k<=_main->nbhd->depth; k++ ) {
+		b = &_main->nbhd->buckets[k];
 
-		r_printf( r, " Bucket: %s\n", id_str( b->id, hexbuf ) );
+		r_printf( r, " Bucket: %i shared bits%s\n", k, (k == _main->nbhd->depth) ? " or more" : "" );
 
 		/* Cycle through all the nodes */
-		item_n = b->nodes->start;
-		while( item_n ) {
-			n = item_n->val;
-
-			r_printf( r, "  Node: %s / %s\n", id_str( n->id, hexbuf ), addr_str( &n->c_addr, addrbuf ) );
-
-			item_n = list_next( item_n );
+		n.s = &b->nodes;
+		for( n.i=0; n.i<b->nodes.count; n.i++ ) {
+			bckt_addr_get( &n, &addr );
+			r_printf( r, "  Node: %s / %s (rtt %i ms, loss %i%%)\n", id_str( b->nodes.id[n.i], hexbuf ), addr_str( &addr, addrbuf ),
+				b->nodes.rtt[n.i], b->nodes.loss[n.i] * 100 / 256 );
 		}
 
-		r_printf( r, "  Found %li entries.\n", b->nodes->counter );
-
-		item_b = list_next( item_b );
+		r_printf( r, "  Found %i entries and %i replacements.\n", b->nodes.count, b->replacements.count );
 	}
 }
 
@@ -205,7 +224,7 @@ void cmd_print_database( REPLY * r ) {
 	while( item_n ) {
 		n = item_n->val;
 
-		r_printf( r, " %s / %s\n", id_str( n->host_id, hexbuf ), addr_str( &n->c_addr, addrbuf ) );
+		r_printf( r, " %s / %s%s\n", id_str( n->host_id, hexbuf ), addr_str( &n->c_addr, addrbuf ), n->cached ? " (cached)" : "" );
 
 		item_n = list_next( item_n );
 	}
@@ -213,11 +232,63 @@ void cmd_print_database( REPLY * r ) {
 	r_printf( r, " Found %li entries.\n", _main->database->list->counter );
 }
 
+#ifdef MEMSTATS
+int cmd_memstat_cmp( const void *a, const void *b ) {
+	const struct obj_memstat *sa = a;
+	const struct obj_memstat *sb = b;
+
+	if( sa->bytes == sb->bytes ) {
+		return 0;
+	}
+	return (sa->bytes < sb->bytes) ? 1 : -1;
+}
+#endif
+
+void cmd_print_memstats( REPLY *r ) {
+#ifdef MEMSTATS
+	static long int last_allocs[MEMSTATS_TAGS];
+	static time_t last_time = 0;
+	struct obj_memstat stats[MEMSTATS_TAGS];
+	time_t now = time_now_sec();
+	long int elapsed = (last_time > 0 && now > last_time) ? now - last_time : 0;
+	long int rate = 0;
+	int tags = 0;
+	int i = 0;
+#endif
+
+	r_printf( r, "Pool memory: %li KiB\n", pool_memory() / 1024 );
+
+#ifdef MEMSTATS
+	tags = mem_stats( stats, MEMSTATS_TAGS );
+
+	/* Rates need the unsorted order */
+	for( i=0; i<tags; i++ ) {
+		rate = elapsed ? (stats[i].allocs - last_allocs[i]) / elapsed : 0;
+		last_allocs[i] = stats[i].allocs;
+		stats[i].allocs = rate;
+	}
+	last_time = now;
+
+	qsort( stats, tags, sizeof(struct obj_memstat), cmd_memstat_cmp );
+
+	r_printf( r, " %-20s %10s %12s %10s\n", "Caller", "Objects", "Bytes", "Allocs/s" );
+	for( i=0; i<tags && i<CMD_MEMSTATS_MAX; i++ ) {
+		r_printf( r, " %-20s %10li %12li %10li\n",
+			stats[i].tag, stats[i].live, stats[i].bytes, stats[i].allocs );
+	}
+#else
+	r_printf( r, "Per caller statistics are not compiled in (FEATURES += memstats).\n" );
+#endif
+}
+
 int cmd_exec( REPLY * r, int argc, char **argv ) {
 	UCHAR id[SHA_DIGEST_LENGTH];
 	char addrbuf[FULL_ADDSTRLEN+1];
 	char hexbuf[HEX_LEN+1];
-	IP *addr;
+	IP c_addr;
+	LOOKUP *l;
+	int found = FALSE;
+	int quorum = 0;
 	int rc = 0;
 
 	if( argc == 0 ) {
@@ -233,35 +304,49 @@ int cmd_exec( REPLY * r, int argc, char **argv ) {
 		/* That is the lookup key */
 		p2p_compute_id( id, argv[1] );
 
-		/* Check my own DB for that node. */
+		/* Check my own DB and earlier results for that node. */
 		mutex_block( _main->p2p->mutex );
-		addr = db_address( id );
+		found = rslv_local( id, &c_addr );
 		mutex_unblock( _main->p2p->mutex );
 
 		r_printf( r, "Lookup %s\n", id_str( id, hexbuf ) );
-		if( addr != NULL ) {
-			r_printf( r, "Address found: %s\n", addr_str( addr, addrbuf ) );
+		if( found ) {
+			r_printf( r, "Address found: %s\n", addr_str( &c_addr, addrbuf ) );
 		} else {
 			r_printf( r ,"No address found.\n" );
 			rc = 1;
 		}
-	} else if( argc == 2 && strcmp( argv[0], "search" ) == 0 ) {
+	} else if( (argc == 2 || argc == 3) && strcmp( argv[0], "search" ) == 0 ) {
 
 		/* That is the lookup key */
 		p2p_compute_id( id, argv[1] );
 
-		/* Start find process */
-		mutex_block( _main->p2p->mutex );
-		lkp_put( id, NULL, NULL );
-		mutex_unblock( _main->p2p->mutex );
-
-		r_printf( r, "Search started for %s.\n", id_str( id, hexbuf ) );
+		/* Cache the result only when that many nodes agree */
+		quorum = (argc == 3) ? atoi( argv[2] ) : _main->conf->lookup_quorum;
+		if( quorum < 1 || quorum > BCKT_K ) {
+			r_printf( r, "Invalid quorum. Use 1 to %i.\n", BCKT_K );
+			rc = 1;
+		} else {
+			/* Start find process */
+			mutex_block( _main->p2p->mutex );
+			l = lkp_put( id, _main->conf->lookup_deadline, quorum, NULL, NULL );
+			mutex_unblock( _main->p2p->mutex );
+
+			if( l != NULL ) {
+				r_printf( r, "Search started for %s.\n", id_str( id, hexbuf ) );
+			} else {
+				r_printf( r, "Too many lookups. Search rejected for %s.\n", id_str( id, hexbuf ) );
+				rc = 1;
+			}
+		}
 	} else if( strcmp( argv[0], "status" ) == 0 ) {
 		cmd_print_status( r );
 	} else if( strcmp( argv[0], "print_nodes" ) == 0 ) {
 		cmd_print_nodes( r );
 	} else if( strcmp( argv[0], "print_database" ) == 0 ) {
 		cmd_print_database( r );
+	} else if( strcmp( argv[0], "memstats" ) == 0 ) {
+		cmd_print_memstats( r );
 	} else if( strcmp( argv[0], "shutdown" ) == 0 ) {
 
 		r_printf( r, "Shutting down now.\n" );
@@ -351,6 +436,9 @@ void *cmd_remote_loop( void *_ ) {
 			continue;
 		}
 
+		/* Datagrams are not terminated: Do not read the rest of an earlier, longer one */
+		request[rc] = '\0';
+
 		/* init reply and reserve room for return status */
 		r_init( &reply );
 		r_printf( &reply, "_" );
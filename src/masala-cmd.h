@@ -17,6 +17,9 @@ You should have received a copy of the GNU General Public License
 along with masala.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+/* Rows of the memstats table that fit into one reply */
+#define CMD_MEMSTATS_MAX 20
+
 /* A UDP packet sized reply */
 typedef struct Reply {
 	char data[1500];
@@ -42,6 +42,7 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 #include "p2p.h"
 #include "random.h"
 #include "database.h"
+#include "resolver.h"
 #include "malloc.h"
 #include "masala-dns.h"
 
@@ -124,6 +125,7 @@ union resource_data
 	struct { char *name; } ptr_record;
 	struct { uint preference; char *exchange; } mx_record;
 	struct { UCHAR addr[16]; } aaaa_record;
+	struct { char *mname; char *rname; ulong serial; ulong refresh; ulong retry; ulong expire; ulong minimum; } soa_record;
 };
 
 /* Resource Record Section */
@@ -159,6 +161,9 @@ struct message
 	struct question question;
 	struct ResourceRecord answer;
 
+	/* SOA of negative answers */
+	struct ResourceRecord authority;
+
 	/* Buffer for the qName part. */
 	char qName_buffer[256];
 };
@@ -193,8 +198,8 @@ void put32bits( UCHAR** buffer, ulong value )
 {
 	(*buffer)[0] = (value & 0xFF000000) >> 24;
 	(*buffer)[1] = (value & 0xFF0000) >> 16;
-	(*buffer)[2] = (value & 0xFF00) >> 16;
-	(*buffer)[3] = (value & 0xFF) >> 16;
+	(*buffer)[2] = (value & 0xFF00) >> 8;
+	(*buffer)[3] = value & 0xFF;
 	(*buffer) += 4;
 }
 
@@ -297,8 +302,8 @@ void dns_code_header( struct message *msg, UCHAR** buffer )
 {
 	put16bits( buffer, msg->id );
 
-	/* Set response flag only */
-	put16bits( buffer, (1 << 15) );
+	/* Set response flag, authoritative flag and response code only */
+	put16bits( buffer, (1 << 15) | ( msg->aa ? AA_MASK : 0 ) | ( msg->rcode & RCODE_MASK ) );
 
 	put16bits( buffer, msg->qdCount );
 	put16bits( buffer, msg->anCount );
@@ -350,14 +355,18 @@ int dns_decode_query( struct message *msg, const UCHAR *buffer, int size )
 
 UCHAR *dns_code_response( struct message *msg, UCHAR *buffer )
 {
+	UCHAR *rd_length;
+
 	dns_code_header( msg, &buffer );
 
-	if( msg->anCount == 1 ) {
+	if( msg->question.qName ) {
 		/* Attach a single question section. */
 		dns_code_domain( &buffer, msg->question.qName );
 		put16bits( &buffer, msg->question.qType );
 		put16bits( &buffer, msg->question.qClass );
+	}
 
+	if( msg->anCount == 1 ) {
 		/* Attach a single resource section. */
 		dns_code_domain( &buffer, msg->answer.name );
 		put16bits( &buffer, msg->answer.type );
@@ -368,10 +377,102 @@ UCHAR *dns_code_response( struct message *msg, UCHAR *buffer )
 		memcpy( buffer, &msg->answer.rd_data.aaaa_record.addr, 16 );
 		buffer += 16;
 	}
+
+	if( msg->nsCount == 1 ) {
+		/* Attach a single SOA record to the authority section. */
+		dns_code_domain( &buffer, msg->authority.name );
+		put16bits( &buffer, msg->authority.type );
+		put16bits( &buffer, msg->authority.class );
+		put32bits( &buffer, msg->authority.ttl );
+
+		/* Length is known after the names are encoded */
+		rd_length = buffer;
+		buffer += 2;
+
+		dns_code_domain( &buffer, msg->authority.rd_data.soa_record.mname );
+		dns_code_domain( &buffer, msg->authority.rd_data.soa_record.rname );
+		put32bits( &buffer, msg->authority.rd_data.soa_record.serial );
+		put32bits( &buffer, msg->authority.rd_data.soa_record.refresh );
+		put32bits( &buffer, msg->authority.rd_data.soa_record.retry );
+		put32bits( &buffer, msg->authority.rd_data.soa_record.expire );
+		put32bits( &buffer, msg->authority.rd_data.soa_record.minimum );
+
+		put16bits( &rd_length, buffer - rd_length - 2 );
+	}
 	return buffer;
 }
 
-void dns_reply( void *ctx, UCHAR *id, UCHAR *address ) {
+/*
+* The name could not be resolved. The SOA record tells resolvers
+* for how long they may cache that (RFC 2308).
+*/
+void dns_reply_nxdomain( struct task *task ) {
+	UCHAR buf[512];
+	struct message *msg;
+	struct ResourceRecord *rr;
+	struct question *qu;
+	char *zone;
+	char addrbuf[FULL_ADDSTRLEN+1];
+
+	msg = &task->msg;
+	rr = &msg->authority;
+	qu = &msg->question;
+
+	/* The zone is the top level domain, e.g. "p2p" */
+	zone = strrchr( qu->qName, '.' );
+	zone = zone ? zone + 1 : qu->qName;
+
+	msg->qr = 1;
+	msg->aa = 1;
+	msg->ra = 0;
+	msg->rcode = NameError_ResponseType;
+	msg->anCount = 0;
+	msg->nsCount = 1;
+	msg->arCount = 0;
+
+	rr->name = zone;
+	rr->type = SOA_Resource_RecordType;
+	rr->class = qu->qClass;
+	rr->ttl = _main->conf->negative_ttl;
+	rr->rd_data.soa_record.mname = zone;
+	rr->rd_data.soa_record.rname = zone;
+	rr->rd_data.soa_record.serial = 1;
+	rr->rd_data.soa_record.refresh = RSLV_TTL;
+	rr->rd_data.soa_record.retry = RSLV_TTL;
+	rr->rd_data.soa_record.expire = RSLV_TTL;
+	rr->rd_data.soa_record.minimum = _main->conf->negative_ttl;
+
+	UCHAR* p = dns_code_response( msg, buf );
+
+	log_debug( "DNS: send NXDOMAIN for '%s' to %s.", qu->qName, addr_str( &task->clientaddr, addrbuf ) );
+
+	sendto( task->sockfd, buf, p - buf, 0, (struct sockaddr*) &task->clientaddr, sizeof(IP) );
+}
+
+/* Too busy to resolve the name right now */
+void dns_reply_servfail( struct task *task ) {
+	UCHAR buf[512];
+	struct message *msg;
+	char addrbuf[FULL_ADDSTRLEN+1];
+
+	msg = &task->msg;
+
+	msg->qr = 1;
+	msg->aa = 0;
+	msg->ra = 0;
+	msg->rcode = ServerFailure_ResponseType;
+	msg->anCount = 0;
+	msg->nsCount = 0;
+	msg->arCount = 0;
+
+	UCHAR* p = dns_code_response( msg, buf );
+
+	log_debug( "DNS: send SERVFAIL for '%s' to %s.", msg->question.qName, addr_str( &task->clientaddr, addrbuf ) );
+
+	sendto( task->sockfd, buf, p - buf, 0, (struct sockaddr*) &task->clientaddr, sizeof(IP) );
+}
+
+void dns_reply( void *ctx, UCHAR *id, UCHAR *address, int missing ) {
 	UCHAR buf[512];
 	IP record;
 	struct message *msg;
@@ -383,8 +484,16 @@ void dns_reply( void *ctx, UCHAR *id, UCHAR *address ) {
 
 	task = (struct task *) ctx;
 
-	if( address == NULL )
+	/* Nobody could be asked: Do not claim the name does not exist */
+	if( address == NULL && !missing ) {
+		dns_reply_servfail( task );
 		goto end;
+	}
+
+	if( address == NULL ) {
+		dns_reply_nxdomain( task );
+		goto end;
+	}
 
 	msg = &task->msg;
 	rr = &msg->answer;
@@ -427,27 +536,46 @@ void dns_reply( void *ctx, UCHAR *id, UCHAR *address ) {
 }
 
 void dns_lookup( CALLBACK *callback, void* ctx, UCHAR *id ) {
-	IP *addr;
+	LOOKUP *l;
+	IP addr;
+	int found = FALSE;
+	int failed = FALSE;
 
-	/* Check my own DB for that node. */
+	/* Check my own DB and earlier results for that node. */
 	mutex_block( _main->p2p->mutex );
-	addr = db_address( id );
+	found = rslv_local( id, &addr );
+	if( !found ) {
+		failed = rslv_negative( id );
+	}
 	mutex_unblock( _main->p2p->mutex );
 
-	if( addr != NULL ) {
-		callback( ctx, id, (UCHAR *) &addr->sin6_addr.s6_addr[0] );
+	if( found ) {
+		callback( ctx, id, (UCHAR *) &addr.sin6_addr.s6_addr[0], FALSE );
+		return;
+	}
+
+	/* Failed a moment ago: Do not ask the network again */
+	if( failed ) {
+		callback( ctx, id, NULL, TRUE );
 		return;
 	}
 
 	/* Start find process */
 	mutex_block( _main->p2p->mutex );
-	lkp_put( id, callback, ctx );
+	l = lkp_put( id, _main->conf->lookup_deadline, _main->conf->dns_quorum, callback, ctx );
 	mutex_unblock( _main->p2p->mutex );
+
+	/* Too many lookups */
+	if( l == NULL ) {
+		callback( ctx, id, NULL, FALSE );
+	}
 }
 
 int dns_masala_lookup( const char *hostname, size_t size, IP *clientaddr, IP *record ) {
 	UCHAR host_id[SHA_DIGEST_LENGTH];
-	IP *addr;
+	IP addr;
+	int found = FALSE;
+	int failed = FALSE;
 	char hexbuf[HEX_LEN+1];
 
 	/* Validate hostname */
@@ -460,22 +588,31 @@ int dns_masala_lookup( const char *hostname, size_t size, IP *clientaddr, IP *re
 	p2p_compute_id( host_id, (char *)hostname );
 	log_debug( "DNS: Lookup %s as '%s'.", hostname, id_str( host_id, hexbuf ) );
 
-	/* Check my own DB for that node. */
+	/* Check my own DB and earlier results for that node. */
 	mutex_block( _main->p2p->mutex );
-	addr = db_address( host_id );
+	found = rslv_local( host_id, &addr );
+	if( !found ) {
+		failed = rslv_negative( host_id );
+	}
 	mutex_unblock( _main->p2p->mutex );
 
-	if( addr != NULL ) {
+	if( found ) {
 		log_debug( "DNS: Found entry for '%s'.", hostname );
-		memcpy( &record->sin6_addr, &addr->sin6_addr, 16 );
+		memcpy( &record->sin6_addr, &addr.sin6_addr, 16 );
 		return 1;
 	}
 
+	/* Failed a moment ago: Do not ask the network again */
+	if( failed ) {
+		log_debug( "DNS: '%s' failed to resolve recently.", hostname );
+		return -1;
+	}
+
 	log_debug( "DNS: No local entry found. Create P2P task for '%s'.", hostname  );
 
 	/* Start find process */
 	mutex_block( _main->p2p->mutex );
-	lkp_put( host_id, NULL, NULL );
+	lkp_put( host_id, _main->conf->lookup_deadline, _main->conf->dns_quorum, NULL, NULL );
 	mutex_unblock( _main->p2p->mutex );
 
 	return -1;
@@ -42,6 +42,7 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 #include "p2p.h"
 #include "random.h"
 #include "database.h"
+#include "resolver.h"
 #include "malloc.h"
 #include "masala-nss.h"
 
@@ -55,21 +56,31 @@ void nss_reply( int sockfd, IP *clientaddr, UCHAR *node_id, IP* node_addr ) {
 }
 
 void nss_lookup( int sockfd, IP *clientaddr, UCHAR *node_id ) {
-	IP *node_addr;
+	IP node_addr;
+	int found = FALSE;
+	int failed = FALSE;
 
-	/* Check my own DB for that node. */
+	/* Check my own DB and earlier results for that node. */
 	mutex_block( _main->p2p->mutex );
-	node_addr = db_address( node_id );
+	found = rslv_local( node_id, &node_addr );
+	if( !found ) {
+		failed = rslv_negative( node_id );
+	}
 	mutex_unblock( _main->p2p->mutex );
 
-	if( node_addr != NULL ) {
-		nss_reply( sockfd, clientaddr, node_id, node_addr );
+	if( found ) {
+		nss_reply( sockfd, clientaddr, node_id, &node_addr );
+		return;
+	}
+
+	/* Failed a moment ago: Do not ask the network again */
+	if( failed ) {
 		return;
 	}
 
 	/* Start find process */
 	mutex_block( _main->p2p->mutex );
-	lkp_put( node_id, NULL, NULL );
+	lkp_put( node_id, _main->conf->lookup_deadline, _main->conf->nss_quorum, NULL, NULL );
 	mutex_unblock( _main->p2p->mutex );
 }
 
@@ -44,6 +44,7 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 #include "p2p.h"
 #include "random.h"
 #include "database.h"
+#include "resolver.h"
 #include "malloc.h"
 #include "masala-web.h"
 
@@ -54,12 +55,17 @@ const char *reply_fmt = "HTTP/1.1 200 OK\r\n"
 "Content-Type: text/plain\r\n"
 "\r\n%s";
 
+const char *busy_fmt = "HTTP/1.1 503 Service Unavailable\r\n"
+"Connection: close\r\n"
+"Content-Length: 0\r\n"
+"\r\n";
+
 struct request {
 	int clientfd;
 	IP clientaddr;
 };
 
-void web_reply( void *ctx, UCHAR *id, UCHAR *address ) {
+void web_reply( void *ctx, UCHAR *id, UCHAR *address, int missing ) {
 	char buffer[512];
 	char addrbuf[INET6_ADDRSTRLEN+1];
 	char hexbuf[HEX_LEN+1];
@@ -74,6 +80,9 @@ void web_reply( void *ctx, UCHAR *id, UCHAR *address ) {
 		log_debug( "Web: Answer request for '%s':\n%s", id_str( id, hexbuf ), addrbuf );
 
 		sendto( request->clientfd, buffer, strlen( buffer ), 0, (struct sockaddr*) &request->clientaddr, sizeof(IP) );
+	} else if( !missing ) {
+		/* Too busy or nobody to ask */
+		sendto( request->clientfd, busy_fmt, strlen( busy_fmt ), 0, (struct sockaddr*) &request->clientaddr, sizeof(IP) );
 	}
 
 	close( request->clientfd );
@@ -81,22 +90,39 @@ void web_reply( void *ctx, UCHAR *id, UCHAR *address ) {
 }
 
 void web_lookup( CALLBACK *callback, void* ctx, UCHAR *id ) {
-	IP *addr;
+	LOOKUP *l;
+	IP addr;
+	int found = FALSE;
+	int failed = FALSE;
 
-	/* Check my own DB for that node. */
+	/* Check my own DB and earlier results for that node. */
 	mutex_block( _main->p2p->mutex );
-	addr = db_address( id );
+	found = rslv_local( id, &addr );
+	if( !found ) {
+		failed = rslv_negative( id );
+	}
 	mutex_unblock( _main->p2p->mutex );
 
-	if( addr != NULL ) {
-		callback( ctx, id, (UCHAR *) &addr->sin6_addr );
+	if( found ) {
+		callback( ctx, id, (UCHAR *) &addr.sin6_addr, FALSE );
+		return;
+	}
+
+	/* Failed a moment ago: Do not ask the network again */
+	if( failed ) {
+		callback( ctx, id, NULL, TRUE );
 		return;
 	}
 
 	/* Start find process */
 	mutex_block( _main->p2p->mutex );
-	lkp_put( id, callback, ctx );
+	l = lkp_put( id, _main->conf->lookup_deadline, _main->conf->web_quorum, callback, ctx );
 	mutex_unblock( _main->p2p->mutex );
+
+	/* Too many lookups */
+	if( l == NULL ) {
+		callback( ctx, id, NULL, FALSE );
+	}
 }
 
 void* web_loop( void* _ ) {
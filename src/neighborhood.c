@@ -49,6 +49,7 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 #include "ben.h"
 #include "p2p.h"
 #include "bucket.h"
+#include "id.h"
 #include "send_p2p.h"
 #include "lookup.h"
 #include "announce.h"
@@ -56,7 +57,7 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 #include "time.h"
 #include "random.h"
 
-LIST *nbhd_init( void ) {
+NBHD *nbhd_init( void ) {
 	return bckt_init();
 }
 
@@ -64,287 +65,382 @@ void nbhd_free( void ) {
 	bckt_free( _main->nbhd );
 }
 
-void nbhd_put( UCHAR *id, IP *sa ) {
-	ITEM *item_n = NULL;
-	NODE *n = NULL;
+/*
+ * direct: The packet came from the node itself. Otherwise some other node
+ * told us about it and the node needs to prove that it is alive.
+ */
+void nbhd_put( UCHAR *id, IP *sa, int direct ) {
+	NODE n;
+	IP addr;
 
 	/* It's me */
-	if( node_me( id ) ) {
+	if( id_me( id ) ) {
 		return;
 	}
 
-	if( (item_n = bckt_find_node( _main->nbhd, id )) != NULL ) {
-		/* Node found */
-		n = item_n->val;
-		nbhd_update_address( n, sa );
-
-	} else {
-		n = (NODE *) myalloc( sizeof(NODE), "nbhd_put" );
-
-		/* ID */
-		memcpy( n->id, id, SHA_DIGEST_LENGTH );
-
-		/* Timings */
-		n->time_ping = time_add_5_min_approx();
-		n->time_find = time_add_5_min_approx();
-		n->pinged = 1;
-
-		/* Update IP address */
-		nbhd_update_address( n, sa );
-
-		bckt_put( _main->nbhd, n );
-
-		/* Send a PING */
-		send_ping( &n->c_addr, SEND_UNICAST );
-
-		/* New node: Ask for myself */
-		send_find( &n->c_addr, _main->conf->node_id );
+	if( bckt_find_node( _main->nbhd, id, &n ) ) {
+		/* Node found: Only the node itself may refresh its entry */
+		if( direct == NBHD_DIRECT ) {
+			bckt_touch( _main->nbhd, &n, sa );
+		}
+		return;
 	}
-}
-
-void nbhd_del( NODE *n ) {
-	bckt_del( _main->nbhd, n );
-}
 
-void nbhd_split( void ) {
-	/* Do as many splits as neccessary */
-	for( ;; ) {
-		if( !bckt_split( _main->nbhd, _main->conf->node_id ) ) {
-			return;
+	if( bckt_put( _main->nbhd, id, sa, direct, &n ) ) {
+		/* New node: Ask for myself. The reply proves that it is alive. */
+		if( p2p_budget() ) {
+			send_find( sa, _main->conf->node_id );
 		}
+
+	} else if( n.s->pinged[n.i] == 0 && p2p_budget() ) {
+		/* The bucket is full: Is the least recently seen node still alive? */
+		bckt_addr_get( &n, &addr );
+		send_ping( &addr, SEND_UNICAST );
+		n.s->pinged[n.i]++;
 	}
 }
 
 void nbhd_send( IP *sa, UCHAR *node_id, UCHAR *lkp_id, UCHAR *session_id, UCHAR *reply_type ) {
-	ITEM *i = NULL;
-	BUCK *b = NULL;
+	NODE nodes[BCKT_K];
+	long int size = 0;
 
-	if( (i = bckt_find_any_match( _main->nbhd, node_id )) == NULL ) {
+	/* Reply with close and fast nodes that answered our last ping */
+	if( (size = bckt_find_best( _main->nbhd, node_id, nodes, BCKT_K, BCKT_VERIFIED )) == 0 ) {
 		return;
 	}
-	b = i->val;
 
-	send_node( sa, b, session_id, lkp_id, reply_type );
+	send_node( sa, nodes, size, session_id, lkp_id, reply_type );
 }
 
 void nbhd_ping( void ) {
-	ITEM *item_b = NULL;
-	BUCK *b = NULL;
-	ITEM *item_n = NULL;
-	NODE *n = NULL;
-	long int j = 0, k = 0;
+	SLOTS *s = NULL;
+	IP addr;
+	NODE n;
+	int k = 0;
+	unsigned int now = bckt_time( _main->nbhd, time_now_sec() );
+	unsigned int later = bckt_time( _main->nbhd, time_add_5_min_approx() );
 
 	/* Cycle through all the buckets */
-	item_b = _main->nbhd->start;
-	for( k=0; k<_main->nbhd->counter; k++ ) {
-		b = item_b->val;
+	for( k=0; k<=_main->nbhd->depth; k++ ) {
+		s = &_main->nbhd->buckets[k].nodes;
+		n.s = s;
 
 		/* Cycle through all the nodes */
-		item_n = b->nodes->start;
-		for( j=0; j<b->nodes->counter; j++ ) {
-			n = item_n->val;
-
-			/* It's time for pinging */
-			if( _main->p2p->time_now.tv_sec > n->time_ping ) {
+		for( n.i=0; n.i<s->count; n.i++ ) {
 
-				/* Ping the first 8 nodes. Sort out the rest. */
-				if( j < 8 ) {
-					send_ping( &n->c_addr, SEND_UNICAST );
+			/* It's time for pinging. The rest waits for the next round. */
+			if( now > s->time_ping[n.i] ) {
+				if( !p2p_budget() ) {
+					return;
 				}
 
-				nbhd_pinged( n->id );
-			}
+				bckt_addr_get( &n, &addr );
+				send_ping( &addr, SEND_UNICAST );
 
-			item_n = list_next( item_n );
+				s->pinged[n.i]++;
+				s->time_ping[n.i] = later;
+			}
 		}
-
-		item_b = list_next( item_b );
 	}
 }
 
-void nbhd_find_myself( void ) {
-	nbhd_find( _main->conf->node_id );
-}
+/* Search a random id within every bucket that has been quiet for too long */
+void nbhd_refresh( void ) {
+	UCHAR find_id[SHA_DIGEST_LENGTH];
+	BUCK *b = NULL;
+	int k = 0;
+	unsigned int now = bckt_time( _main->nbhd, time_now_sec() );
+
+	for( k=0; k<=_main->nbhd->depth; k++ ) {
+		b = &_main->nbhd->buckets[k];
+
+		if( b->time_touched > 0 && now - b->time_touched < BCKT_REFRESH ) {
+			continue;
+		}
 
-void nbhd_find_random( void ) {
-	UCHAR node_id[SHA_DIGEST_LENGTH];
+		bckt_random_id( _main->nbhd, k, find_id );
+		if( nbhd_find( find_id ) == 0 ) {
+			/* Out of budget */
+			return;
+		}
 
-	rand_urandom( node_id, SHA_DIGEST_LENGTH );
-	nbhd_find( node_id );
+		b->time_touched = now;
+	}
 }
 
-void nbhd_find( UCHAR *find_id ) {
-	ITEM *item_b = NULL;
-	BUCK *b = NULL;
-	ITEM *item_n = NULL;
-	NODE *n = NULL;
+/* Unpaced search for our own id and into every empty bucket */
+void nbhd_join( int alpha, int max ) {
+	UCHAR find_id[SHA_DIGEST_LENGTH];
+	NODE nodes[BCKT_K];
+	IP addr;
+	long int size = 0;
 	long int j = 0;
+	int sent = 0;
+	int k = 0;
+
+	size = bckt_find_closest( _main->nbhd, _main->conf->node_id, nodes, alpha, BCKT_ALL );
+	for( j=0; j<size && sent<max; j++ ) {
+		bckt_addr_get( &nodes[j], &addr );
+		send_find( &addr, _main->conf->node_id );
+		sent++;
+	}
 
-	if( (item_b = bckt_find_any_match( _main->nbhd, find_id )) != NULL ) {
-		b = item_b->val;
+	/* The last bucket is covered by the search for our own id */
+	for( k=0; k<_main->nbhd->depth && sent<max; k++ ) {
+		if( _main->nbhd->buckets[k].nodes.count > 0 ) {
+			continue;
+		}
 
-		item_n = b->nodes->start;
-		for( j=0; j<b->nodes->counter; j++ ) {
-			n = item_n->val;
+		bckt_random_id( _main->nbhd, k, find_id );
+		if( bckt_find_closest( _main->nbhd, find_id, nodes, 1, BCKT_ALL ) == 0 ) {
+			continue;
+		}
 
-			/* Maintainance search */
-			if( _main->p2p->time_now.tv_sec > n->time_find ) {
+		bckt_addr_get( &nodes[0], &addr );
+		send_find( &addr, find_id );
+		sent++;
+	}
+}
 
-				send_find( &n->c_addr, find_id );
-				n->time_find = time_add_5_min_approx();
-			}
+/* Maintainance search. Returns the number of packets sent. */
+int nbhd_find( UCHAR *find_id ) {
+	NODE nodes[BCKT_K];
+	IP addr;
+	long int size = 0;
+	long int j = 0;
 
-			item_n = list_next( item_n );
+	size = bckt_find_closest( _main->nbhd, find_id, nodes, BCKT_K, BCKT_ALL );
+	for( j=0; j<size; j++ ) {
+		if( !p2p_budget() ) {
+			break;
 		}
+
+		bckt_addr_get( &nodes[j], &addr );
+		send_find( &addr, find_id );
 	}
+
+	return j;
 }
 
 void nbhd_lookup( LOOKUP *l ) {
-	ITEM *item_b = NULL;
-	BUCK *b = NULL;
-	ITEM *item_n = NULL;
+	NODE nodes[BCKT_K];
 	NODE *n = NULL;
+	IP addr;
+	long int size = 0;
 	long int j = 0;
-	long int max = 0;
 
-	/* Find a matching bucket */
-	if( (item_b = bckt_find_any_match( _main->nbhd, l->find_id )) == NULL ) {
-		return;
+	/* Start with 8 close nodes. Prefer fast ones. */
+	size = bckt_find_best( _main->nbhd, l->find_id, nodes, BCKT_K, BCKT_ALL );
+	for( j=0; j<size; j++ ) {
+		n = &nodes[j];
+		bckt_addr_get( n, &addr );
+		lkp_insert( l, n->s->id[n->i], &addr, 1 );
 	}
+}
 
-	/* Ask the first 8 nodes for the requested node */
-	b = item_b->val;
-	item_n = b->nodes->start;
-	max = ( b->nodes->counter < 8 ) ? b->nodes->counter : 8;
-	for( j = 0; j < max; j++ ) {
-		n = item_n->val;
-
-		/* Remember node */
-		lkp_remember( l, n->id );
+void nbhd_announce( ANNOUNCE *a, UCHAR *host_id ) {
+	NODE nodes[2 * BCKT_K];
+	NODE *n = NULL;
+	IP addr;
+	long int size = 0;
+	long int j = 0;
 
-		/* Direct lookup */
-		send_lookup( &n->c_addr, l->find_id, l->lkp_id );
+	/* Ask close nodes, 8 by default. Prefer fast ones. */
+	size = bckt_find_best( _main->nbhd, host_id, nodes, p2p_scale( BCKT_K ), BCKT_ALL );
+	for( j=0; j<size; j++ ) {
+		n = &nodes[j];
 
-		item_n = list_next( item_n );
+		/* Remember node and send announcement */
+		bckt_addr_get( n, &addr );
+		announce_remember( a, n->s->id[n->i], &addr );
 	}
 }
 
-void nbhd_announce( ANNOUNCE *a, UCHAR *host_id ) {
-	ITEM *item_b = NULL;
-	BUCK *b = NULL;
-	ITEM *item_n = NULL;
-	NODE *n = NULL;
-	long int j = 0;
-	long int max = 0;
+void nbhd_ponged( UCHAR *id, IP *sa ) {
+	NODE n;
 
-	/* Find a matching bucket */
-	if( (item_b = bckt_find_any_match( _main->nbhd, host_id )) == NULL ) {
+	if( !bckt_find_node( _main->nbhd, id, &n ) ) {
 		return;
 	}
 
-	/* Ask the first 8 nodes */
-	b = item_b->val;
-	item_n = b->nodes->start;
-	max = ( b->nodes->counter < 8 ) ? b->nodes->counter : 8;
-	for( j = 0; j < max; j++ ) {
-		n = item_n->val;
+	bckt_touch( _main->nbhd, &n, sa );
+
+	/* ~5 minutes */
+	n.s->time_ping[n.i] = bckt_time( _main->nbhd, time_add_5_min_approx() );
+}
+
+void nbhd_expire( void ) {
+	long int expired = bckt_expire( _main->nbhd, NBHD_DEAD );
+
+	if( expired > 0 ) {
+		log_info( "Expired %li nodes (%li in total)", expired, _main->nbhd->expired );
+	}
+}
+
+/* Write the node id and all verified nodes to a file */
+void nbhd_save( void ) {
+	char *filename = _main->conf->nodes_file;
+	char *tmpname = NULL;
+	char *buffer = NULL;
+	char *p = NULL;
+	SLOTS *s = NULL;
+	size_t size = NBHD_HEADER + nbhd_count() * NBHD_ENTRY;
+	int i = 0;
+	int k = 0;
+
+	if( filename == NULL ) {
+		return;
+	}
 
-		/* Remember node */
-		announce_remember( a, n->id );
+	buffer = (char *) myalloc( size, "nbhd_save" );
+	memcpy( buffer, NBHD_MAGIC, 4 );
+	memcpy( buffer + 4, _main->conf->node_id, SHA_DIGEST_LENGTH );
 
-		/* Send announcement */
-		send_announce( &n->c_addr, a->lkp_id, host_id );
+	p = buffer + NBHD_HEADER;
+	for( k=0; k<=_main->nbhd->depth; k++ ) {
+		s = &_main->nbhd->buckets[k].nodes;
+		for( i=0; i<s->count; i++ ) {
+			if( s->pinged[i] > 0 ) {
+				continue;
+			}
+			memcpy( p, s->id[i], SHA_DIGEST_LENGTH );
+			memcpy( p + SHA_DIGEST_LENGTH, s->addr[i], BCKT_ADDRLEN );
+			p += NBHD_ENTRY;
+		}
+	}
+	size = p - buffer;
 
-		item_n = list_next( item_n );
+	/* Replace the old snapshot atomically */
+	tmpname = (char *) myalloc( strlen( filename ) + 5, "nbhd_save" );
+	sprintf( tmpname, "%s.tmp", filename );
+	if( file_write( tmpname, buffer, size ) < 0 || rename( tmpname, filename ) != 0 ) {
+		log_info( "Unable to write nodes file %s", filename );
 	}
+
+	myfree( tmpname, "nbhd_save" );
+	myfree( buffer, "nbhd_save" );
 }
 
-void nbhd_pinged( UCHAR *id ) {
-	ITEM *item_n = NULL;
-	NODE *n = NULL;
+/*
+ * Restore the node id and the nodes of the last run. They count as
+ * unverified and are pinged first thing, as fast as the budget allows.
+ */
+void nbhd_load( void ) {
+	char *filename = _main->conf->nodes_file;
+	char *buffer = NULL;
+	char *p = NULL;
+	size_t size = 0;
+	IP addr;
+	NODE n;
+	int count = 0;
+
+	if( filename == NULL || !file_isreg( filename ) ) {
+		return;
+	}
 
-	if( (item_n = bckt_find_node( _main->nbhd, id )) == NULL ) {
+	size = file_size( filename );
+	if( size < NBHD_HEADER || (size - NBHD_HEADER) % NBHD_ENTRY != 0 ) {
+		log_info( "Ignoring broken nodes file %s", filename );
 		return;
 	}
 
-	n = item_n->val;
-	n->pinged++;
+	if( (buffer = file_load( filename, 0, size )) == NULL ) {
+		return;
+	}
 
-	/* ~5 minutes */
-	n->time_ping = time_add_5_min_approx();
+	if( memcmp( buffer, NBHD_MAGIC, 4 ) != 0 ) {
+		log_info( "Ignoring broken nodes file %s", filename );
+		myfree( buffer, "nbhd_load" );
+		return;
+	}
+
+	memcpy( _main->conf->node_id, buffer + 4, SHA_DIGEST_LENGTH );
+
+	memset( &addr, '\0', sizeof(IP) );
+	addr.sin6_family = AF_INET6;
+	for( p = buffer + NBHD_HEADER; p < buffer + size; p += NBHD_ENTRY ) {
+		if( id_me( (UCHAR *)p ) || bckt_find_node( _main->nbhd, (UCHAR *)p, &n ) ) {
+			continue;
+		}
+
+		memcpy( &addr.sin6_addr, p + SHA_DIGEST_LENGTH, 16 );
+		memcpy( &addr.sin6_port, p + SHA_DIGEST_LENGTH + 16, 2 );
+
+		if( bckt_put( _main->nbhd, (UCHAR *)p, &addr, NBHD_INDIRECT, &n ) ) {
+			bckt_find_node( _main->nbhd, (UCHAR *)p, &n );
+			n.s->time_ping[n.i] = 0;
+			count++;
+		}
+	}
+
+	log_info( "Restored %i nodes from %s", count, filename );
+
+	myfree( buffer, "nbhd_load" );
 }
 
-void nbhd_ponged( UCHAR *id, IP *sa ) {
-	ITEM *item_n = NULL;
-	NODE *n = NULL;
+/* A reply arrived after rtt ms */
+void nbhd_answered( UCHAR *id, long int rtt ) {
+	NODE n;
 
-	if( (item_n = bckt_find_node( _main->nbhd, id )) == NULL ) {
-		return;
+	if( bckt_find_node( _main->nbhd, id, &n ) ) {
+		bckt_answered( &n, rtt );
 	}
+}
 
-	n = item_n->val;
-	n->pinged = 0;
+/* A request to this address timed out */
+void nbhd_lost( IP *sa ) {
+	NODE n;
 
-	/* ~5 minutes */
-	n->time_ping = time_add_5_min_approx();
+	if( !bckt_find_addr( _main->nbhd, sa, &n ) ) {
+		return;
+	}
+	bckt_lost( &n );
 
-	memcpy( &n->c_addr, sa, sizeof(IP) );
+	/* Silent since our last ping and somebody waits for the slot: Swap it right away */
+	if( n.s->pinged[n.i] > 0 && bckt_contested( _main->nbhd, &n ) ) {
+		bckt_del( _main->nbhd, &n );
+		_main->nbhd->expired++;
+	}
 }
 
-void nbhd_expire( void ) {
-	ITEM *next = NULL;
-	ITEM *item_b = NULL;
-	BUCK *b = NULL;
-	ITEM *item_n = NULL;
-	NODE *n = NULL;
-	long int j = 0, k = 0;
+/* How long to wait for a reply before asking somebody else */
+long int nbhd_timeout( UCHAR *id ) {
+	NODE n;
+	long int timeout = NBHD_TIMEOUT_MAX;
 
-	/* Cycle through all the buckets */
-	item_b = _main->nbhd->start;
-	for( k=0; k<_main->nbhd->counter; k++ ) {
-		b = item_b->val;
+	if( bckt_find_node( _main->nbhd, id, &n ) && n.s->rtt[n.i] > 0 ) {
+		timeout = 4 * n.s->rtt[n.i];
+	}
 
-		/* Cycle through all the nodes */
-		item_n = b->nodes->start;
-		for( j=0; j<b->nodes->counter; j++ ) {
-			n = item_n->val;
-			next = list_next( item_n );
-
-			/* Bad node */
-			if( n->pinged >= 4 ) {
-				/* Delete references */
-				nbhd_del( n );
-			}
+	if( timeout < NBHD_TIMEOUT_MIN ) {
+		return NBHD_TIMEOUT_MIN;
+	} else if( timeout > NBHD_TIMEOUT_MAX ) {
+		return NBHD_TIMEOUT_MAX;
+	}
 
-			item_n = next;
-		}
+	return timeout;
+}
 
-		item_b = list_next( item_b );
+int nbhd_count( void ) {
+	int count = 0;
+	int k;
+
+	for( k=0; k<=_main->nbhd->depth; k++ ) {
+		count += _main->nbhd->buckets[k].nodes.count;
 	}
+
+	return count;
 }
 
 /* Are all buckets empty? */
 int nbhd_empty( void ) {
-	ITEM *item_b;
-	BUCK *b;
-	long int k;
+	int k;
 
 	/* Cycle through all the buckets */
-	item_b = _main->nbhd->start;
-	for( k=0; k<_main->nbhd->counter; k++ ) {
-		b = item_b->val;
-
-		if( b->nodes->counter > 0)
+	for( k=0; k<=_main->nbhd->depth; k++ ) {
+		if( _main->nbhd->buckets[k].nodes.count > 0)
 			return 0;
-
-		item_b = list_next( item_b );
 	}
 
 	return 1;
 }
-
-void nbhd_update_address( NODE *n, IP *sa ) {
-	if( memcmp( &n->c_addr, sa, sizeof(IP)) != 0 ) {
-		memcpy( &n->c_addr, sa, sizeof(IP) );
-	}
-}
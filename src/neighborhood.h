@@ -17,28 +17,46 @@ You should have received a copy of the GNU General Public License
 along with masala.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-LIST *nbhd_init( void );
+#define NBHD_INDIRECT 0
+#define NBHD_DIRECT 1
+
+/* Bad nodes: Unanswered pings */
+#define NBHD_DEAD 4
+
+/* Request timeouts in ms: A few round trips, within these bounds */
+#define NBHD_TIMEOUT_MIN 100
+#define NBHD_TIMEOUT_MAX 1000
+
+/* Snapshot: magic, own node id, then node id / address pairs */
+#define NBHD_MAGIC "MSN1"
+#define NBHD_HEADER (4 + SHA_DIGEST_LENGTH)
+#define NBHD_ENTRY (SHA_DIGEST_LENGTH + BCKT_ADDRLEN)
+
+NBHD *nbhd_init( void );
 void nbhd_free( void );
 
-void nbhd_put( UCHAR *id, IP *sa );
-void nbhd_del( NODE *n );
+void nbhd_put( UCHAR *id, IP *sa, int direct );
 
-void nbhd_split( void );
 void nbhd_ping( void );
 
-void nbhd_find_myself( void );
-void nbhd_find_random( void );
-void nbhd_find( UCHAR *find_id );
+void nbhd_refresh( void );
+void nbhd_join( int alpha, int max );
+int nbhd_find( UCHAR *find_id );
 void nbhd_lookup( LOOKUP *l );
 void nbhd_announce( ANNOUNCE *a, UCHAR *host_id );
 
 void nbhd_send( IP *sa, UCHAR *node_id, UCHAR *lkp_id, UCHAR *session_id, UCHAR *reply_type );
 void nbhd_print( void );
 
-void nbhd_pinged( UCHAR *id );
 void nbhd_ponged( UCHAR *id, IP *sa );
+void nbhd_answered( UCHAR *id, long int rtt );
+void nbhd_lost( IP *sa );
+long int nbhd_timeout( UCHAR *id );
 
 void nbhd_expire( void );
 
+void nbhd_save( void );
+void nbhd_load( void );
+
+int nbhd_count( void );
 int nbhd_empty( void );
-void nbhd_update_address( NODE *n, IP *sa );
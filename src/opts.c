@@ -52,15 +52,26 @@ const char *usage = "Masala - A P2P name resolution daemon (IPv6 only)\n"
 " -d, --daemon		Run the node in background.\n"
 " -q, --quiet		Be quiet and do not log anything.\n"
 " -pf, --pid-file	Write process pid to a file.\n"
+" -nf, --nodes-file	Keep node id and verified nodes in a file across restarts.\n"
+" -nt, --negative-ttl	Remember names that failed to resolve for this many seconds (Default: 30).\n"
+" -ld, --lookup-deadline	Give up on a lookup after this many milliseconds (Default: 5000).\n"
+" -lp, --lookup-packets	Send at most this many requests per lookup (Default: 32).\n"
+" -lm, --lookup-max	Run at most this many lookups at once, as many again may wait (Default: 64).\n"
+" -lq, --lookup-quorum	Answer when this many nodes return the same address (Default: 1).\n"
 #ifdef DNS
 " -da, --dns-addr	Bind the DNS server to this address (Default: '::1').\n"
 " -dp, --dns-port	Bind the DNS server to this port (Default: 3444).\n"
 " -di, --dns-ifce	Bind the DNS server to this interface (Default: <any>).\n"
+" -dq, --dns-quorum	Quorum of DNS queries (Default: see -lq).\n"
 #endif
 #ifdef WEB
 " -wa, --web-addr	Bind the WEB server to this address (Default: '::1').\n"
 " -wp, -web-port	Bind the WEB server to this port (Default: 8080).\n"
 " -wi, --web-ifce	Bind the WEB server to this interface (Default: <any>).\n"
+" -wq, --web-quorum	Quorum of WEB requests (Default: see -lq).\n"
+#endif
+#ifdef NSS
+" -nq, --nss-quorum	Quorum of NSS requests (Default: see -lq).\n"
 #endif
 "\n"
 "Example: masala -h fubar.p2p -k fubar\n"
@@ -106,7 +117,7 @@ void replace( char *var, char** dst, char *src ) {
 		arg_expected( var );
 
 	myfree( *dst, "opts_replace" );
-	*dst = strdup( src );
+	*dst = mystrdup( src, "opts_replace" );
 }
 
 void opts_interpreter( char *var, char *val ) {
@@ -117,6 +128,28 @@ void opts_interpreter( char *var, char *val ) {
 		replace( var, &_main->conf->bootstrap_port, val );
 	} else if( match( var, "-pf", "--pid-file" ) ) {
 		replace( var, &_main->conf->pid_file, val );
+	} else if( match( var, "-nf", "--nodes-file" ) ) {
+		replace( var, &_main->conf->nodes_file, val );
+	} else if( match( var, "-nt", "--negative-ttl" ) ) {
+		if( val == NULL )
+			arg_expected( var );
+		_main->conf->negative_ttl = atoi( val );
+	} else if( match( var, "-ld", "--lookup-deadline" ) ) {
+		if( val == NULL )
+			arg_expected( var );
+		_main->conf->lookup_deadline = atoi( val );
+	} else if( match( var, "-lp", "--lookup-packets" ) ) {
+		if( val == NULL )
+			arg_expected( var );
+		_main->conf->lookup_packets = atoi( val );
+	} else if( match( var, "-lm", "--lookup-max" ) ) {
+		if( val == NULL )
+			arg_expected( var );
+		_main->conf->lookup_max = atoi( val );
+	} else if( match( var, "-lq", "--lookup-quorum" ) ) {
+		if( val == NULL )
+			arg_expected( var );
+		_main->conf->lookup_quorum = atoi( val );
 	} else if( match( var, "-h", "--hostname" ) ) {
 		replace( var, &_main->conf->hostname, val );
 
@@ -133,6 +166,10 @@ void opts_interpreter( char *var, char *val ) {
 		replace( var, &_main->conf->dns_addr, val );
 	} else if( match( var, "-di", "--dns-ifce" ) ) {
 		replace( var, &_main->conf->dns_ifce, val );
+	} else if( match( var, "-dq", "--dns-quorum" ) ) {
+		if( val == NULL )
+			arg_expected( var );
+		_main->conf->dns_quorum = atoi( val );
 #endif
 #ifdef WEB
 	} else if( match( var, "-wp", "--web-port" ) ) {
@@ -141,6 +178,16 @@ void opts_interpreter( char *var, char *val ) {
 		replace( var, &_main->conf->web_addr, val );
 	} else if( match( var, "-wi", "--web-ifce" ) ) {
 		replace( var, &_main->conf->web_ifce, val );
+	} else if( match( var, "-wq", "--web-quorum" ) ) {
+		if( val == NULL )
+			arg_expected( var );
+		_main->conf->web_quorum = atoi( val );
+#endif
+#ifdef NSS
+	} else if( match( var, "-nq", "--nss-quorum" ) ) {
+		if( val == NULL )
+			arg_expected( var );
+		_main->conf->nss_quorum = atoi( val );
 #endif
 	} else if( match( var, "-p", "--port" ) ) {
 		replace( var, &_main->conf->port, val );
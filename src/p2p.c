@@ -34,6 +34,9 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 #include <signal.h>
 #include <netdb.h>
 #include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <linux/sockios.h>
 
 #include "malloc.h"
 #include "thrd.h"
@@ -49,6 +52,7 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 #include "udp.h"
 #include "ben.h"
 #include "bucket.h"
+#include "id.h"
 #include "lookup.h"
 #include "announce.h"
 #include "neighborhood.h"
@@ -60,20 +64,32 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 #include "random.h"
 #include "sha1.h"
 #include "database.h"
+#include "resolver.h"
 
 struct obj_p2p *p2p_init( void ) {
 	struct obj_p2p *p2p = (struct obj_p2p *) myalloc( sizeof(struct obj_p2p), "p2p_init" );
 
-	p2p->time_maintainance = 0;
 	p2p->time_multicast = 0;
 	p2p->time_announce = 0;
 	p2p->time_restart = 0;
 	p2p->time_expire = 0;
-	p2p->time_split = 0;
-	p2p->time_find = 0;
-	p2p->time_ping = 0;
+	p2p->time_save = time_add_5_min_approx();
 
-	gettimeofday( &p2p->time_now, NULL );
+	p2p->tokens = P2P_BURST;
+	p2p->time_tokens = time_now_msec();
+
+	p2p->time_start = time_now_msec();
+	p2p->time_join = 0;
+	p2p->time_ready = 0;
+	p2p->join_nodes = 0;
+	p2p->join_rounds = 0;
+
+	p2p->gain = P2P_GAIN;
+	p2p->loss = 0;
+	p2p->slow = 0;
+	p2p->send_errors = 0;
+	p2p->time_control = time_now_msec();
+	p2p->time_cpu = 0;
 
 	/* Worker Concurrency */
 	p2p->mutex = mutex_init();
@@ -86,6 +102,42 @@ void p2p_free( void ) {
 	myfree( _main->p2p, "p2p_free" );
 }
 
+/*
+ * Every round searches our own id at the closest nodes known so far and a
+ * random id within every empty bucket. The answers bring closer nodes for
+ * the next round. P2P_JOIN_ROUNDS rounds in a row without new nodes end the
+ * join phase, so a slow or lossy link does not look finished too early.
+ */
+void p2p_join( void ) {
+	long long int now = time_now_msec();
+	int nodes = 0;
+
+	if( now < _main->p2p->time_join ) {
+		return;
+	}
+
+	nodes = nbhd_count();
+	if( nodes == _main->p2p->join_nodes ) {
+		_main->p2p->join_rounds++;
+	} else {
+		_main->p2p->join_rounds = 0;
+	}
+
+	if( _main->p2p->join_rounds >= P2P_JOIN_ROUNDS ) {
+		_main->p2p->time_ready = now - _main->p2p->time_start;
+		if( _main->p2p->time_ready == 0 ) {
+			_main->p2p->time_ready = 1;
+		}
+		log_info( "Routing table ready after %li ms with %i nodes", _main->p2p->time_ready, nodes );
+		return;
+	}
+
+	_main->p2p->join_nodes = nodes;
+	_main->p2p->time_join = now + P2P_JOIN_INTERVAL;
+
+	nbhd_join( P2P_JOIN_ALPHA, P2P_JOIN_PARALLEL );
+}
+
 void p2p_bootstrap( void ) {
 	struct addrinfo hints;
 	struct addrinfo *info = NULL;
@@ -120,12 +172,123 @@ void p2p_bootstrap( void ) {
 	freeaddrinfo( info );
 }
 
-void p2p_parse( UCHAR *bencode, size_t bensize, IP *from ) {
-	/* Tick Tock */
-	mutex_block( _main->p2p->mutex );
-	gettimeofday( &_main->p2p->time_now, NULL );
-	mutex_unblock( _main->p2p->mutex );
+/*
+ * Maintenance traffic may send one packet per token. Tokens trickle in at
+ * P2P_RATE per second, so pings and finds get spread over time instead of
+ * leaving in bursts.
+ */
+int p2p_budget( void ) {
+	long long int now = time_now_msec();
+	long int rate = p2p_scale( P2P_RATE );
+	long long int tokens = (now - _main->p2p->time_tokens) * rate / 1000;
+
+	if( tokens > 0 ) {
+		/* Long idle: Do not overflow, the bucket is full anyway */
+		if( tokens > 2 * P2P_BURST ) {
+			tokens = 2 * P2P_BURST;
+		}
+		_main->p2p->tokens += tokens;
+		_main->p2p->time_tokens += tokens * 1000 / rate;
+		if( _main->p2p->tokens > P2P_BURST ) {
+			_main->p2p->tokens = P2P_BURST;
+			_main->p2p->time_tokens = now;
+		}
+	}
+
+	if( _main->p2p->tokens <= 0 ) {
+		return 0;
+	}
+
+	_main->p2p->tokens--;
+	return 1;
+}
+
+/* Client lookups are never delayed. They use up the budget of maintenance. */
+void p2p_charge( int packets ) {
+	_main->p2p->tokens -= packets;
+	if( _main->p2p->tokens < -P2P_BURST ) {
+		_main->p2p->tokens = -P2P_BURST;
+	}
+}
+
+/*
+ * Additive increase while requests get lost or lookups miss P2P_SLO,
+ * multiplicative decrease when the send queue, the CPU or sendto() give
+ * up. Calm rounds move the gain back to the default.
+ */
+void p2p_control( void ) {
+	long long int now = time_now_msec();
+	long long int cpu = 0;
+	long int busy = 0;
+	int queued = 0;
+	int gain = _main->p2p->gain;
+	struct rusage usage;
+
+	if( now - _main->p2p->time_control < P2P_CONTROL_INTERVAL ) {
+		return;
+	}
+
+	/* CPU time since the last round */
+	getrusage( RUSAGE_SELF, &usage );
+	cpu = ( usage.ru_utime.tv_sec + usage.ru_stime.tv_sec ) * 1000 +
+		( usage.ru_utime.tv_usec + usage.ru_stime.tv_usec ) / 1000;
+	busy = ( cpu - _main->p2p->time_cpu ) * 1000 / ( now - _main->p2p->time_control );
+
+	/* Bytes waiting in the send queue */
+	if( _main->udp->sockfd < 0 || ioctl( _main->udp->sockfd, SIOCOUTQ, &queued ) < 0 ) {
+		queued = 0;
+	}
+
+	if( queued > P2P_QUEUE_HIGH || busy > P2P_CPU_HIGH || _main->p2p->send_errors > 0 ) {
+		gain /= 2;
+	} else if( _main->p2p->loss > P2P_LOSS_HIGH || _main->p2p->slow > 0 ) {
+		gain += 10;
+	} else if( gain > P2P_GAIN ) {
+		gain -= 5;
+	} else if( gain < P2P_GAIN ) {
+		gain += 5;
+	}
+
+	if( gain < P2P_GAIN_MIN ) {
+		gain = P2P_GAIN_MIN;
+	} else if( gain > P2P_GAIN_MAX ) {
+		gain = P2P_GAIN_MAX;
+	}
+
+	if( gain != _main->p2p->gain ) {
+		log_info( "Fan-out %i%%: loss %li/1000, %i slow lookups, %li send errors, cpu %li/1000, queue %i bytes",
+			gain, _main->p2p->loss, _main->p2p->slow, _main->p2p->send_errors, busy, queued );
+	}
+
+	_main->p2p->gain = gain;
+	_main->p2p->slow = 0;
+	_main->p2p->send_errors = 0;
+	_main->p2p->time_control = now;
+	_main->p2p->time_cpu = cpu;
+}
+
+/* Default fan-out n adjusted by the controller */
+int p2p_scale( int n ) {
+	n = n * _main->p2p->gain / 100;
+	return ( n < 1 ) ? 1 : n;
+}
+
+/* Moving average of lost requests in per mille */
+void p2p_loss( int lost ) {
+	_main->p2p->loss -= _main->p2p->loss / 16;
+	if( lost ) {
+		_main->p2p->loss += 1000 / 16;
+	}
+}
+
+/* Time until a lookup got its first answer */
+void p2p_observe( long int msec ) {
+	if( msec > P2P_SLO ) {
+		_main->p2p->slow++;
+	}
+}
 
+void p2p_parse( UCHAR *bencode, size_t bensize, IP *from ) {
 	/* UDP packet too small */
 	if( bensize < 1 ) {
 		log_info( "UDP packet too small" );
@@ -165,7 +328,7 @@ void p2p_decode( UCHAR *bencode, size_t bensize, IP *from ) {
 		log_info( "Node ID missing or broken" );
 		ben_free( packet );
 		return;
-	} else if( node_me( id->v.s->s ) ) {
+	} else if( id_me( id->v.s->s ) ) {
 		if( !nbhd_empty() ) {
 			/* Received packet from myself 
 			 * If the node_counter is 0, 
@@ -186,9 +349,6 @@ void p2p_decode( UCHAR *bencode, size_t bensize, IP *from ) {
 		return;
 	}
 
-	/* Remember node. */
-	nbhd_put( id->v.s->s, (IP *)from );
-
 	/* Query Details */
 	q = ben_searchDictStr( packet, "q" );
 	if( !ben_is_str( q ) || ben_str_size( q ) != 1 ) {
@@ -199,6 +359,9 @@ void p2p_decode( UCHAR *bencode, size_t bensize, IP *from ) {
 
 	mutex_block( _main->p2p->mutex );
 
+	/* Remember node. */
+	nbhd_put( id->v.s->s, (IP *)from, NBHD_DIRECT );
+
 	switch( *q->v.s->s ) {
 
 		/* Requests */
@@ -218,6 +381,10 @@ void p2p_decode( UCHAR *bencode, size_t bensize, IP *from ) {
 			/* LOOKUP */
 			p2p_lookup( packet, key->v.s->s, from );
 			break;
+		case 'c':
+			/* STORE */
+			p2p_store( packet, from );
+			break;
 
 		/* Replies */
 		case 'o':
@@ -250,56 +417,76 @@ void p2p_decode( UCHAR *bencode, size_t bensize, IP *from ) {
 	ben_free( packet );
 }
 
+/* Wake up often while requests are in flight. Their timeouts are short. */
+int p2p_wait( void ) {
+	if( _main->lkps->list->counter > 0 || _main->announce->list->counter > 0 ) {
+		return P2P_TICK;
+	}
+	return CONF_EPOLL_WAIT;
+}
+
 void p2p_cron( void ) {
 	/* Tick Tock */
-	gettimeofday( &_main->p2p->time_now, NULL );
+	time_t now = time_now_sec();
 
 	/* Expire objects every ~2 minutes */
-	if( _main->p2p->time_now.tv_sec > _main->p2p->time_expire ) {
-		announce_expire();
-		cache_expire();
+	if( now > _main->p2p->time_expire ) {
 		nbhd_expire();
-		lkp_expire();
 		db_expire();
+		rslv_expire();
 		_main->p2p->time_expire = time_add_2_min_approx();
 	}
 
+	/* Unanswered requests. Contested slots go to a waiting node right away. */
+	cache_expire();
+
+	/* Adjust the fan-out */
+	p2p_control();
+
+	/* Lookup deadlines and request timeouts */
+	lkp_expire();
+	announce_expire();
+
+	/* Keep popular names fresh */
+	rslv_prefetch();
+
+	/* Snapshot of the routing table every ~5 minutes */
+	if( now > _main->p2p->time_save ) {
+		nbhd_save();
+		_main->p2p->time_save = time_add_5_min_approx();
+	}
+
 	if( nbhd_empty() ) {
 
 		/* Bootstrap PING */
-		if( _main->p2p->time_now.tv_sec > _main->p2p->time_restart ) {
+		if( now > _main->p2p->time_restart ) {
 			p2p_bootstrap();
 			_main->p2p->time_restart = time_add_2_min_approx();
 		}
 
-	} else {
-
-		/* Split container every ~2 minutes */
-		if( _main->p2p->time_now.tv_sec > _main->p2p->time_split ) {
-			nbhd_split();
-			_main->p2p->time_split = time_add_2_min_approx();
+		/* Start over */
+		if( _main->p2p->time_ready > 0 ) {
+			_main->p2p->time_start = time_now_msec();
+			_main->p2p->time_ready = 0;
+			_main->p2p->join_nodes = 0;
+			_main->p2p->join_rounds = 0;
 		}
 
-		/* Ping all nodes every ~2 minutes */
-		if( _main->p2p->time_now.tv_sec > _main->p2p->time_ping ) {
-			nbhd_ping();
-			_main->p2p->time_ping = time_add_2_min_approx();
-		}
+	} else {
 
-		/* Find nodes every ~2 minutes */
-		if( _main->p2p->time_now.tv_sec > _main->p2p->time_find ) {
-			nbhd_find_myself();
-			_main->p2p->time_find = time_add_2_min_approx();
-		}
+		/* Ping the nodes that are due, as far as the budget allows */
+		nbhd_ping();
 
-		/* Find random node every ~2 minutes for maintainance reasons */
-		if( _main->p2p->time_now.tv_sec > _main->p2p->time_maintainance ) {
-			nbhd_find_random();
-			_main->p2p->time_maintainance = time_add_2_min_approx();
+		if( _main->p2p->time_ready == 0 ) {
+			/* Fill the routing table fast */
+			p2p_join();
+		} else {
+			/* Refresh quiet buckets */
+			nbhd_refresh();
 		}
 
 		/* Announce my hostname every ~5 minutes */
-		if( _main->p2p->time_now.tv_sec > _main->p2p->time_announce ) {
+		if( now > _main->p2p->time_announce ) {
 			p2p_announce_myself();
 			_main->p2p->time_announce = time_add_5_min_approx();
 		}
@@ -307,7 +494,7 @@ void p2p_cron( void ) {
 
 	/* Try to register multicast address until it works. */
 	if( _main->udp->multicast == 0  ) {
-		if( _main->p2p->time_now.tv_sec > _main->p2p->time_multicast ) {
+		if( now > _main->p2p->time_multicast ) {
 			udp_multicast();
 			_main->p2p->time_multicast = time_add_5_min_approx();
 		}
@@ -380,11 +567,14 @@ void p2p_lookup( struct obj_ben *packet, UCHAR *session_id, IP *from ) {
 
 		/* Reply closer nodes */
 		nbhd_send( from, ben_find_id->v.s->s, ben_lkp_id->v.s->s, session_id, (UCHAR *)"L");
+
+		/* The lookup may store its result with us */
+		cache_query( ben_lkp_id->v.s->s, ben_find_id->v.s->s, from );
 	}
 }
 
 void p2p_pong( UCHAR *node_id, UCHAR *session_id, IP *from ) {
-	if( !cache_validate( session_id) ) {
+	if( !cache_validate( session_id, node_id ) ) {
 		log_info( "Unexpected reply! Many answers to one multicast request?" );
 		return;
 	}
@@ -393,6 +583,47 @@ void p2p_pong( UCHAR *node_id, UCHAR *session_id, IP *from ) {
 	nbhd_ponged( node_id, from );
 }
 
+void p2p_store( struct obj_ben *packet, IP *from ) {
+	struct obj_ben *ben_host_id = NULL;
+	struct obj_ben *ben_lkp_id = NULL;
+	struct obj_ben *ben_address = NULL;
+	IP sin;
+
+	/* Host ID */
+	ben_host_id = ben_searchDictStr( packet, "f" );
+	if( !p2p_is_hash( ben_host_id ) ) {
+		log_info( "Missing or broken target node" );
+		return;
+	}
+
+	/* Lookup ID */
+	ben_lkp_id = ben_searchDictStr( packet, "l" );
+	if( !p2p_is_hash( ben_lkp_id ) ) {
+		log_info( "Missing or broken lookup ID" );
+		return;
+	}
+
+	/* Address */
+	ben_address = ben_searchDictStr( packet, "a" );
+	if( !p2p_is_ip( ben_address ) ) {
+		log_info( "Missing or broken store address" );
+		return;
+	}
+
+	/* Nobody asked us for that host */
+	if( !cache_stored( ben_lkp_id->v.s->s, ben_host_id->v.s->s, from ) ) {
+		log_info( "Unsolicited STORE" );
+		return;
+	}
+
+	memset( &sin, '\0', sizeof(IP) );
+	sin.sin6_family = AF_INET6;
+	memcpy( &sin.sin6_addr, ben_address->v.s->s, 16 );
+
+	/* Answer remote lookups from this copy as well. The port is unknown. */
+	db_cache( ben_host_id->v.s->s, &sin );
+}
+
 void p2p_node_find( struct obj_ben *packet, UCHAR *node_id, UCHAR *session_id, IP *from ) {
 	struct obj_ben *nodes = NULL;
 	struct obj_ben *node = NULL;
@@ -402,7 +633,7 @@ void p2p_node_find( struct obj_ben *packet, UCHAR *node_id, UCHAR *session_id, I
 	ITEM *item = NULL;
 	IP sin;
 
-	if( !cache_validate( session_id ) ) {
+	if( !cache_validate( session_id, node_id ) ) {
 		log_info( "Unexpected reply!" );
 		return;
 	}
@@ -453,7 +684,7 @@ void p2p_node_find( struct obj_ben *packet, UCHAR *node_id, UCHAR *session_id, I
 		memcpy( &sin.sin6_port, po->v.s->s, 2 );
 
 		/* Store node */
-		nbhd_put( id->v.s->s, (IP *)&sin );
+		nbhd_put( id->v.s->s, (IP *)&sin, NBHD_INDIRECT );
 
 		item = list_next( item );
 	}
@@ -469,7 +700,7 @@ void p2p_node_announce( struct obj_ben *packet, UCHAR *node_id, UCHAR *session_i
 	ITEM *item = NULL;
 	IP sin;
 
-	if( !cache_validate( session_id ) ) {
+	if( !cache_validate( session_id, node_id ) ) {
 		log_info( "Unexpected reply!" );
 		return;
 	}
@@ -488,10 +719,8 @@ void p2p_node_announce( struct obj_ben *packet, UCHAR *node_id, UCHAR *session_i
 		return;
 	}
 
-	/* Announce myself */
-	if( _main->conf->hostname != NULL ) {
-		announce_resolve( ben_lkp_id->v.s->s, node_id, from );
-	}
+	/* Our announcement arrived */
+	announce_answered( ben_lkp_id->v.s->s, node_id );
 
 	/* Reply */
 	item = nodes->v.l->start;
@@ -537,7 +766,7 @@ void p2p_node_announce( struct obj_ben *packet, UCHAR *node_id, UCHAR *session_i
 		}
 
 		/* Store node */
-		nbhd_put( id->v.s->s, (IP *)&sin );
+		nbhd_put( id->v.s->s, (IP *)&sin, NBHD_INDIRECT );
 
 		item = list_next( item );
 	}
@@ -553,7 +782,7 @@ void p2p_node_lookup( struct obj_ben *packet, UCHAR *node_id, UCHAR *session_id,
 	ITEM *item = NULL;
 	IP sin;
 
-	if( !cache_validate( session_id ) ) {
+	if( !cache_validate( session_id, node_id ) ) {
 		log_info( "Unexpected reply!" );
 		return;
 	}
@@ -572,9 +801,6 @@ void p2p_node_lookup( struct obj_ben *packet, UCHAR *node_id, UCHAR *session_id,
 		return;
 	}
 
-	/* Lookup the requested hostname */
-	lkp_resolve( ben_lkp_id->v.s->s, node_id, from );
-
 	/* Reply */
 	item = nodes->v.l->start;
 	while( item ) {
@@ -613,21 +839,24 @@ void p2p_node_lookup( struct obj_ben *packet, UCHAR *node_id, UCHAR *session_id,
 		memcpy( &sin.sin6_addr, ip->v.s->s, 16 );
 		memcpy( &sin.sin6_port, po->v.s->s, 2 );
 
-		/* Lookup the requested hostname */
-		lkp_resolve( ben_lkp_id->v.s->s, id->v.s->s, &sin );
+		/* Candidate for the lookup */
+		lkp_resolve( ben_lkp_id->v.s->s, node_id, id->v.s->s, &sin );
 
 		/* Store node */
-		nbhd_put( id->v.s->s, (IP *)&sin );
+		nbhd_put( id->v.s->s, (IP *)&sin, NBHD_INDIRECT );
 
 		item = list_next( item );
 	}
+
+	/* Ask the next closest nodes */
+	lkp_answered( ben_lkp_id->v.s->s, node_id );
 }
 
 void p2p_value( struct obj_ben *packet, UCHAR *node_id, UCHAR *session_id, IP *from ) {
 	struct obj_ben *ben_address = NULL;
 	struct obj_ben *ben_lkp_id = NULL;
 
-	if( !cache_validate( session_id ) ) {
+	if( !cache_validate( session_id, node_id ) ) {
 		log_info( "Unexpected reply!" );
 		return;
 	}
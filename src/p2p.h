@@ -17,25 +17,79 @@ You should have received a copy of the GNU General Public License
 along with masala.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+/* Maintenance packets per second and the largest burst */
+#define P2P_RATE 10
+#define P2P_BURST 20
+
+/* Join phase: Finds per round, self-lookup width and pause between rounds */
+#define P2P_JOIN_PARALLEL 16
+#define P2P_JOIN_ALPHA 3
+#define P2P_JOIN_INTERVAL 500
+
+/* Rounds in a row without new nodes that end the join phase */
+#define P2P_JOIN_ROUNDS 3
+
+/* Timer resolution in ms for request timeouts */
+#define P2P_TICK 50
+
+/* Fan-out controller: Percent of the default fan-out and rounds in ms */
+#define P2P_GAIN 100
+#define P2P_GAIN_MIN 50
+#define P2P_GAIN_MAX 200
+#define P2P_CONTROL_INTERVAL 1000
+
+/* More fan-out above this loss rate (per mille) or lookup time (ms) */
+#define P2P_LOSS_HIGH 100
+#define P2P_SLO 500
+
+/* Less fan-out above this send queue (bytes) or CPU load (per mille) */
+#define P2P_QUEUE_HIGH 65536
+#define P2P_CPU_HIGH 900
+
 struct obj_p2p {
-	struct timeval time_now;
-	time_t time_maintainance;
 	time_t time_multicast;
 	time_t time_announce;
 	time_t time_restart;
 	time_t time_expire;
-	time_t time_split;
-	time_t time_ping;
-	time_t time_find;
+	time_t time_save;
 	pthread_mutex_t *mutex;
+
+	/* Token bucket for maintenance traffic */
+	long int tokens;
+	long long int time_tokens;
+
+	/* Join phase: time_ready stays 0 until the routing table is populated */
+	long long int time_start;
+	long long int time_join;
+	long int time_ready;
+	int join_nodes;
+	int join_rounds;
+
+	/* Fan-out controller */
+	int gain;
+	long int loss;
+	int slow;
+	long int send_errors;
+	long long int time_control;
+	long long int time_cpu;
 };
 
 struct obj_p2p *p2p_init( void );
 void p2p_free( void );
 
+int p2p_wait( void );
 void p2p_cron( void );
+void p2p_join( void );
 void p2p_bootstrap( void );
 
+int p2p_budget( void );
+void p2p_charge( int packets );
+
+void p2p_control( void );
+int p2p_scale( int n );
+void p2p_loss( int lost );
+void p2p_observe( long int msec );
+
 void p2p_parse( UCHAR *bencode, size_t bensize, IP *from );
 void p2p_decode( UCHAR *bencode, size_t bensize, IP *from );
 
@@ -43,6 +97,7 @@ void p2p_ping( UCHAR *session_id, IP *from );
 void p2p_find( struct obj_ben *packet, UCHAR *session_id, IP *from );
 void p2p_announce( struct obj_ben *packet, UCHAR *session_id, IP *from );
 void p2p_lookup( struct obj_ben *packet, UCHAR *session_id, IP *from );
+void p2p_store( struct obj_ben *packet, IP *from );
 
 void p2p_pong( UCHAR *node_id, UCHAR *session_id, IP *from );
 void p2p_node_find( struct obj_ben *packet, UCHAR *node_id, UCHAR *session_id, IP *from );
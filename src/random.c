@@ -26,6 +26,9 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 #include <semaphore.h>
 #include <signal.h>
 #include <netinet/in.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/random.h>
 
 #include "main.h"
 #include "str.h"
@@ -36,14 +39,150 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 #include "malloc.h"
 #include "log.h"
 
-void rand_urandom( void *buffer, size_t size ) {
+/* Per-thread ChaCha20 keystream */
+struct obj_rand {
+	uint32_t state[16];
+	UCHAR buffer[RAND_BUF];
+	size_t pos;
+	size_t output;
+};
+
+static __thread struct obj_rand *rand_state = NULL;
+
+#define ROTL32( v, n ) (((v) << (n)) | ((v) >> (32 - (n))))
+#define QUARTERROUND( a, b, c, d ) \
+	a += b; d ^= a; d = ROTL32( d, 16 ); \
+	c += d; b ^= c; b = ROTL32( b, 12 ); \
+	a += b; d ^= a; d = ROTL32( d, 8 ); \
+	c += d; b ^= c; b = ROTL32( b, 7 );
+
+void rand_seed( void *buffer, size_t size ) {
 	UCHAR *random = NULL;
+	ssize_t bytes = 0;
+	size_t done = 0;
+
+	while( done < size ) {
+		bytes = getrandom( (UCHAR *)buffer + done, size - done, 0 );
+		if( bytes > 0 ) {
+			done += bytes;
+		} else if( bytes < 0 && errno == EINTR ) {
+			continue;
+		} else {
+			break;
+		}
+	}
 
+	if( done == size ) {
+		return;
+	}
+
+	/* Old kernel */
 	if( ( random = (UCHAR *)file_load( "/dev/urandom", 0, size)) == NULL ) {
 		log_err( "Failed to read /dev/urandom" );
 	}
 
 	memcpy( buffer, random, size );
 
-	myfree( random, "rand_urandom" );
+	myfree( random, "rand_seed" );
+}
+
+void rand_reseed( struct obj_rand *r ) {
+	UCHAR seed[44];
+	int i = 0;
+
+	rand_seed( seed, sizeof(seed) );
+
+	/* "expand 32-byte k" */
+	r->state[0] = 0x61707865;
+	r->state[1] = 0x3320646e;
+	r->state[2] = 0x79622d32;
+	r->state[3] = 0x6b206574;
+
+	/* 256 bit key, 32 bit block counter, 96 bit nonce */
+	for( i=0; i<8; i++ ) {
+		memcpy( &r->state[4+i], seed + 4*i, 4 );
+	}
+	r->state[12] = 0;
+	for( i=0; i<3; i++ ) {
+		memcpy( &r->state[13+i], seed + 32 + 4*i, 4 );
+	}
+
+	memset( seed, '\0', sizeof(seed) );
+
+	r->pos = RAND_BUF;
+	r->output = 0;
+}
+
+void rand_block( struct obj_rand *r, UCHAR *out ) {
+	uint32_t x[16];
+	int i = 0;
+
+	memcpy( x, r->state, sizeof(x) );
+
+	for( i=0; i<10; i++ ) {
+		QUARTERROUND( x[0], x[4], x[8], x[12] );
+		QUARTERROUND( x[1], x[5], x[9], x[13] );
+		QUARTERROUND( x[2], x[6], x[10], x[14] );
+		QUARTERROUND( x[3], x[7], x[11], x[15] );
+		QUARTERROUND( x[0], x[5], x[10], x[15] );
+		QUARTERROUND( x[1], x[6], x[11], x[12] );
+		QUARTERROUND( x[2], x[7], x[8], x[13] );
+		QUARTERROUND( x[3], x[4], x[9], x[14] );
+	}
+
+	for( i=0; i<16; i++ ) {
+		x[i] += r->state[i];
+		out[4*i+0] = x[i];
+		out[4*i+1] = x[i] >> 8;
+		out[4*i+2] = x[i] >> 16;
+		out[4*i+3] = x[i] >> 24;
+	}
+
+	r->state[12]++;
+}
+
+void rand_refill( struct obj_rand *r ) {
+	int i = 0;
+
+	/* Fresh key every RAND_RESEED bytes, long before the counter wraps */
+	if( r->output >= RAND_RESEED ) {
+		rand_reseed( r );
+	}
+
+	for( i=0; i<RAND_BUF; i+=64 ) {
+		rand_block( r, r->buffer + i );
+	}
+
+	r->pos = 0;
+	r->output += RAND_BUF;
+}
+
+void rand_urandom( void *buffer, size_t size ) {
+	struct obj_rand *r = rand_state;
+	UCHAR *p = buffer;
+	size_t n = 0;
+
+	if( r == NULL ) {
+		/* Lives as long as the thread. Threads live as long as the process. */
+		r = (struct obj_rand *) myalloc( sizeof(struct obj_rand), "rand_urandom" );
+		rand_reseed( r );
+		rand_state = r;
+	}
+
+	while( size > 0 ) {
+		if( r->pos >= RAND_BUF ) {
+			rand_refill( r );
+		}
+
+		n = RAND_BUF - r->pos;
+		n = (size < n) ? size : n;
+		memcpy( p, r->buffer + r->pos, n );
+
+		/* Never hand out the same bytes twice */
+		memset( r->buffer + r->pos, '\0', n );
+
+		r->pos += n;
+		p += n;
+		size -= n;
+	}
 }
@@ -17,4 +17,9 @@ You should have received a copy of the GNU General Public License
 along with masala.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+/* Keystream bytes buffered per thread */
+#define RAND_BUF 512
+#define RAND_RESEED 1048576
+
 void rand_urandom( void *buffer, size_t size );
+void rand_seed( void *buffer, size_t size );
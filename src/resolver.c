@@ -0,0 +1,244 @@
+/*
+Copyright 2011 Aiko Barz
+
+This file is part of masala.
+
+masala is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+masala is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with masala.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/epoll.h>
+
+#include "malloc.h"
+#include "main.h"
+#include "log.h"
+#include "list.h"
+#include "hash.h"
+#include "conf.h"
+#include "lookup.h"
+#include "database.h"
+#include "resolver.h"
+#include "time.h"
+
+static POOL rslv_pool = POOL_INIT( sizeof(RSLV), "rslv" );
+
+struct obj_resolver *rslv_init( void ) {
+	struct obj_resolver *resolver = (struct obj_resolver *) myalloc( sizeof(struct obj_resolver), "rslv_init" );
+	resolver->list = list_init();
+	resolver->hash = hash_init( 4096 );
+	return resolver;
+}
+
+void rslv_free( void ) {
+	ITEM *i = NULL;
+
+	i = _main->resolver->list->start;
+	while( i ) {
+		pool_free( &rslv_pool, i->val, "rslv_free" );
+		i = list_next( i );
+	}
+	list_free( _main->resolver->list );
+	hash_free( _main->resolver->hash );
+	myfree( _main->resolver, "rslv_free" );
+}
+
+/* Entry for the result of a lookup */
+RSLV *rslv_put( UCHAR *host_id ) {
+	ITEM *i = NULL;
+	RSLV *r = NULL;
+
+	if( ( i = hash_get( _main->resolver->hash, host_id, SHA_DIGEST_LENGTH ) ) == NULL ) {
+
+		/* Full: Forget the least recently used entry */
+		if( _main->resolver->list->counter >= RSLV_MAX ) {
+			rslv_del( _main->resolver->list->start );
+		}
+
+		r = (RSLV *) pool_alloc( &rslv_pool, POOL_ZERO, "rslv_put" );
+		memcpy( r->host_id, host_id, SHA_DIGEST_LENGTH );
+		r->c_addr.sin6_family = AF_INET6;
+
+		i = list_put( _main->resolver->list, r );
+		hash_put( _main->resolver->hash, r->host_id, SHA_DIGEST_LENGTH, i );
+	} else {
+		r = i->val;
+		list_tail( _main->resolver->list, i );
+	}
+
+	return r;
+}
+
+void rslv_found( UCHAR *host_id, UCHAR *address ) {
+	RSLV *r = rslv_put( host_id );
+
+	memcpy( &r->c_addr.sin6_addr, address, 16 );
+	r->time_expire = time_now_sec() + RSLV_TTL;
+	r->negative = FALSE;
+
+	/* A new period: Popularity fades */
+	r->hits /= 2;
+	r->prefetching = FALSE;
+}
+
+/* Do not ask the network again for a while */
+void rslv_failed( UCHAR *host_id ) {
+	ITEM *i = NULL;
+	RSLV *r = NULL;
+
+	if( _main->conf->negative_ttl <= 0 ) {
+		return;
+	}
+
+	/* A failed refresh keeps the address until it expires */
+	if( ( i = hash_get( _main->resolver->hash, host_id, SHA_DIGEST_LENGTH ) ) != NULL ) {
+		r = i->val;
+		if( !r->negative && time_now_sec() <= r->time_expire ) {
+			return;
+		}
+	}
+
+	r = rslv_put( host_id );
+	memset( &r->c_addr.sin6_addr, '\0', 16 );
+	r->time_expire = time_now_sec() + _main->conf->negative_ttl;
+	r->negative = TRUE;
+}
+
+void rslv_del( ITEM *i ) {
+	RSLV *r = i->val;
+	hash_del( _main->resolver->hash, r->host_id, SHA_DIGEST_LENGTH );
+	list_del( _main->resolver->list, i );
+	pool_free( &rslv_pool, r, "rslv_del" );
+}
+
+void rslv_expire( void ) {
+	ITEM *i = NULL;
+	ITEM *n = NULL;
+	RSLV *r = NULL;
+	time_t now = time_now_sec();
+
+	i = _main->resolver->list->start;
+	while( i ) {
+		r = i->val;
+		n = list_next( i );
+
+		if( now > r->time_expire ) {
+			rslv_del( i );
+		}
+
+		i = n;
+	}
+}
+
+/* Copy the address: The entry may be gone once the mutex is released */
+int rslv_get( UCHAR *host_id, IP *addr ) {
+	ITEM *i = NULL;
+	RSLV *r = NULL;
+
+	if( ( i = hash_get( _main->resolver->hash, host_id, SHA_DIGEST_LENGTH ) ) == NULL ) {
+		_main->resolver->misses++;
+		return FALSE;
+	}
+	r = i->val;
+
+	/* Stale */
+	if( time_now_sec() > r->time_expire ) {
+		rslv_del( i );
+		_main->resolver->misses++;
+		return FALSE;
+	}
+
+	/* Known to fail: Not a miss either */
+	if( r->negative ) {
+		return FALSE;
+	}
+
+	_main->resolver->hits++;
+	r->hits++;
+	list_tail( _main->resolver->list, i );
+	memcpy( addr, &r->c_addr, sizeof(IP) );
+	return TRUE;
+}
+
+/* Announced to us or resolved lately. Call with the mutex held. */
+int rslv_local( UCHAR *host_id, IP *addr ) {
+	IP *db_addr = NULL;
+
+	if( ( db_addr = db_address( host_id ) ) != NULL ) {
+		memcpy( addr, db_addr, sizeof(IP) );
+		return TRUE;
+	}
+
+	return rslv_get( host_id, addr );
+}
+
+int rslv_negative( UCHAR *host_id ) {
+	ITEM *i = NULL;
+	RSLV *r = NULL;
+
+	if( ( i = hash_get( _main->resolver->hash, host_id, SHA_DIGEST_LENGTH ) ) == NULL ) {
+		return FALSE;
+	}
+	r = i->val;
+
+	if( !r->negative || time_now_sec() > r->time_expire ) {
+		return FALSE;
+	}
+
+	_main->resolver->negative_hits++;
+	return TRUE;
+}
+
+/* Look up popular names again shortly before they expire */
+void rslv_prefetch( void ) {
+	ITEM *i = NULL;
+	RSLV *r = NULL;
+	time_t now = time_now_sec();
+	int budget = RSLV_PREFETCH;
+
+	if( now == _main->resolver->time_prefetch ) {
+		return;
+	}
+	_main->resolver->time_prefetch = now;
+
+	/* Leave room for lookups of clients */
+	if( _main->lkps->active >= _main->conf->lookup_max / 2 ) {
+		return;
+	}
+
+	i = _main->resolver->list->start;
+	while( i && budget > 0 ) {
+		r = i->val;
+
+		if( !r->negative && !r->prefetching && r->hits >= RSLV_HOT && r->time_expire - now <= RSLV_AHEAD ) {
+			if( lkp_put( r->host_id, _main->conf->lookup_deadline, _main->conf->lookup_quorum, NULL, NULL ) != NULL ) {
+				r->prefetching = TRUE;
+				_main->resolver->prefetches++;
+				budget--;
+			}
+		}
+
+		i = list_next( i );
+	}
+}
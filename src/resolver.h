@@ -0,0 +1,73 @@
+/*
+Copyright 2011 Aiko Barz
+
+This file is part of masala.
+
+masala is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+masala is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with masala.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Resolved addresses are good until the owner announces again */
+#define RSLV_TTL 300
+
+/* Upper bound of remembered names */
+#define RSLV_MAX 1024
+
+/* Names asked this often per TTL are looked up again before they expire */
+#define RSLV_HOT 3
+#define RSLV_AHEAD 30
+
+/* Refresh lookups per second */
+#define RSLV_PREFETCH 8
+
+struct obj_resolver {
+	LIST *list;
+	HASH *hash;
+
+	long int hits;
+	long int misses;
+	long int negative_hits;
+	long int prefetches;
+
+	time_t time_prefetch;
+};
+
+struct obj_resolved {
+	UCHAR host_id[SHA_DIGEST_LENGTH];
+	IP c_addr;
+	time_t time_expire;
+
+	/* The lookup failed */
+	int negative;
+
+	/* Popularity and refresh in progress */
+	int hits;
+	int prefetching;
+};
+typedef struct obj_resolved RSLV;
+
+struct obj_resolver *rslv_init( void );
+void rslv_free( void );
+
+RSLV *rslv_put( UCHAR *host_id );
+void rslv_found( UCHAR *host_id, UCHAR *address );
+void rslv_failed( UCHAR *host_id );
+void rslv_del( ITEM *i );
+
+void rslv_expire( void );
+
+int rslv_get( UCHAR *host_id, IP *addr );
+int rslv_local( UCHAR *host_id, IP *addr );
+int rslv_negative( UCHAR *host_id );
+
+void rslv_prefetch( void );
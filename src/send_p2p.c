@@ -61,7 +61,7 @@ void send_ping( IP *sa, int type ) {
 	*/
 
 	rand_urandom( session_id, SHA_DIGEST_LENGTH );
-	cache_put( session_id, type );
+	cache_put( session_id, type, sa );
 
 	/* ID */
 	key = ben_init( BEN_STR );
@@ -155,7 +155,7 @@ void send_announce( IP *sa, UCHAR *lkp_id, UCHAR *host_id ) {
 	*/
 
 	rand_urandom( session_id, SHA_DIGEST_LENGTH );
-	cache_put( session_id, SEND_UNICAST );
+	cache_put( session_id, SEND_UNICAST, sa );
 
 	/* ID */
 	key = ben_init( BEN_STR );
@@ -219,7 +219,7 @@ void send_find( IP *sa, UCHAR *node_id ) {
 	*/
 
 	rand_urandom( session_id, SHA_DIGEST_LENGTH );
-	cache_put( session_id, SEND_UNICAST );
+	cache_put( session_id, SEND_UNICAST, sa );
 
 	/* ID */
 	key = ben_init( BEN_STR );
@@ -277,7 +277,7 @@ void send_lookup( IP *sa, UCHAR *node_id, UCHAR *lkp_id ) {
 	*/
 
 	rand_urandom( session_id, SHA_DIGEST_LENGTH );
-	cache_put( session_id, SEND_UNICAST );
+	cache_put( session_id, SEND_UNICAST, sa );
 
 	/* ID */
 	key = ben_init( BEN_STR );
@@ -324,16 +324,15 @@ void send_lookup( IP *sa, UCHAR *node_id, UCHAR *lkp_id ) {
 	log_info( "LOOKUP %s at %s", id_str( node_id, hexbuf ), addr_str( sa, addrbuf ) );
 }
 
-void send_node( IP *sa, BUCK *b, UCHAR *session_id, UCHAR *lkp_id, UCHAR *reply_type ) {
+void send_node( IP *sa, NODE *nodes, long int size, UCHAR *session_id, UCHAR *lkp_id, UCHAR *reply_type ) {
 	struct obj_ben *dict = ben_init( BEN_DICT );
 	struct obj_ben *list_id = NULL;
 	struct obj_ben *dict_node = NULL;
 	struct obj_ben *key = NULL;
 	struct obj_ben *val = NULL;
 	struct obj_raw *raw = NULL;
-	ITEM *item_n = NULL;
 	NODE *n = NULL;
-	IP *sin = NULL;
+	long int j = 0;
 	char addrbuf[FULL_ADDSTRLEN+1];
 
 	/*
@@ -381,18 +380,8 @@ void send_node( IP *sa, BUCK *b, UCHAR *session_id, UCHAR *lkp_id, UCHAR *reply_
 	ben_dict( dict, key, list_id );
 
 	/* Insert nodes */
-	item_n = b->nodes->start;
-	while( item_n ) {
-		n = item_n->val;
-
-		/* Do not include nodes, that are questionable */
-		if( n->pinged > 0 ) {
-			item_n = list_next( item_n );
-			continue;
-		}
-
-		/* Network data */
-		sin = (IP*)&n->c_addr;
+	for( j=0; j<size; j++ ) {
+		n = &nodes[j];
 
 		/* List object */
 		dict_node = ben_init( BEN_DICT );
@@ -402,24 +391,22 @@ void send_node( IP *sa, BUCK *b, UCHAR *session_id, UCHAR *lkp_id, UCHAR *reply_
 		key = ben_init( BEN_STR );
 		val = ben_init( BEN_STR );
 		ben_str( key,( UCHAR *)"i", 1 );
-		ben_str( val, n->id, SHA_DIGEST_LENGTH );
+		ben_str( val, n->s->id[n->i], SHA_DIGEST_LENGTH );
 		ben_dict( dict_node, key, val );
 
 		/* IP */
 		key = ben_init( BEN_STR );
 		val = ben_init( BEN_STR );
 		ben_str( key,( UCHAR *)"a", 1 );
-		ben_str( val,( UCHAR *)&sin->sin6_addr, 16 );
+		ben_str( val, n->s->addr[n->i], 16 );
 		ben_dict( dict_node, key, val );
 
 		/* Port */
 		key = ben_init( BEN_STR );
 		val = ben_init( BEN_STR );
 		ben_str( key,( UCHAR *)"p", 1 );
-		ben_str( val,( UCHAR *)&sin->sin6_port, 2 );
+		ben_str( val, n->s->addr[n->i] + 16, 2 );
 		ben_dict( dict_node, key, val );
-
-		item_n = list_next( item_n );
 	}
 
 	/* Query */
@@ -449,6 +436,79 @@ void send_node( IP *sa, BUCK *b, UCHAR *session_id, UCHAR *lkp_id, UCHAR *reply_
 	}
 }
 
+/* Path caching: A copy of a value for a node on the lookup path */
+void send_store( IP *sa, UCHAR *host_id, UCHAR *lkp_id, UCHAR *address ) {
+	struct obj_ben *dict = ben_init( BEN_DICT );
+	struct obj_ben *key = NULL;
+	struct obj_ben *val = NULL;
+	struct obj_raw *raw = NULL;
+	UCHAR session_id[SHA_DIGEST_LENGTH];
+	char addrbuf[FULL_ADDSTRLEN+1];
+
+	/*
+		1:i 20:NODE_ID
+		1:k 20:SESSION_ID
+		1:f 20:HOST_ID
+		1:l 20:LOOKUP_ID
+		1:a 16:IP
+		1:q 1:c
+	*/
+
+	/* No reply expected */
+	rand_urandom( session_id, SHA_DIGEST_LENGTH );
+
+	/* ID */
+	key = ben_init( BEN_STR );
+	val = ben_init( BEN_STR );
+	ben_str( key,( UCHAR *)"i", 1 );
+	ben_str( val, _main->conf->node_id, SHA_DIGEST_LENGTH );
+	ben_dict( dict, key, val );
+
+	/* Session key */
+	key = ben_init( BEN_STR );
+	val = ben_init( BEN_STR );
+	ben_str( key,( UCHAR *)"k", 1 );
+	ben_str( val, session_id, SHA_DIGEST_LENGTH );
+	ben_dict( dict, key, val );
+
+	/* Host ID */
+	key = ben_init( BEN_STR );
+	val = ben_init( BEN_STR );
+	ben_str( key,( UCHAR *)"f", 1 );
+	ben_str( val, host_id, SHA_DIGEST_LENGTH );
+	ben_dict( dict, key, val );
+
+	/* Lookup ID */
+	key = ben_init( BEN_STR );
+	val = ben_init( BEN_STR );
+	ben_str( key,( UCHAR *)"l", 1 );
+	ben_str( val, lkp_id, SHA_DIGEST_LENGTH );
+	ben_dict( dict, key, val );
+
+	/* IP */
+	key = ben_init( BEN_STR );
+	val = ben_init( BEN_STR );
+	ben_str( key,( UCHAR *)"a", 1 );
+	ben_str( val, address, 16 );
+	ben_dict( dict, key, val );
+
+	/* Query */
+	key = ben_init( BEN_STR );
+	val = ben_init( BEN_STR );
+	ben_str( key,( UCHAR *)"q", 1 );
+	ben_str( val,( UCHAR *)"c", 1 );
+	ben_dict( dict, key, val );
+
+	raw = ben_enc( dict );
+	send_exec( sa, raw );
+
+	raw_free( raw );
+	ben_free( dict );
+
+	/* Log */
+	log_info( "STORE to %s", addr_str( sa, addrbuf ) );
+}
+
 void send_value( IP *sa, IP *value, UCHAR *session_id, UCHAR *lkp_id ) {
 	struct obj_ben *dict = ben_init( BEN_DICT );
 	struct obj_ben *key = NULL;
@@ -516,5 +576,7 @@ void send_exec( IP *sa, struct obj_raw *raw ) {
 		return;
 	}
 
-	sendto( _main->udp->sockfd, raw->code, raw->size, 0, (const struct sockaddr *)sa, addrlen );
+	if( sendto( _main->udp->sockfd, raw->code, raw->size, 0, (const struct sockaddr *)sa, addrlen ) < 0 ) {
+		_main->p2p->send_errors++;
+	}
 }
@@ -27,7 +27,8 @@ void send_announce( IP *sa, UCHAR *lkp_id, UCHAR *host_id );
 void send_find( IP *sa, UCHAR *node_id );
 void send_lookup( IP *sa, UCHAR *node_id, UCHAR *lkp_id );
 
-void send_node( IP *sa, BUCK *b, UCHAR *session_id, UCHAR *lkp_id, UCHAR *reply_type );
+void send_node( IP *sa, NODE *nodes, long int size, UCHAR *session_id, UCHAR *lkp_id, UCHAR *reply_type );
 void send_value( IP *sa, IP *value, UCHAR *session_id, UCHAR *lkp_id );
+void send_store( IP *sa, UCHAR *host_id, UCHAR *lkp_id, UCHAR *address );
 
 void send_exec( IP *sa, struct obj_raw *raw );
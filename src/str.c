@@ -35,11 +35,14 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 #include "str.h"
 #include "conf.h"
 
+static POOL str_pool = POOL_INIT( sizeof(struct obj_str), "str" );
+
 struct obj_str *str_init( UCHAR *buf, long int len ) {
-	struct obj_str *str = (struct obj_str *) myalloc( sizeof(struct obj_str), "str_init" );
+	struct obj_str *str = (struct obj_str *) pool_alloc( &str_pool, POOL_DIRTY, "str_init" );
 	
-	str->s = (UCHAR *) myalloc( (len+1) * sizeof(UCHAR), "str_init" );
+	str->s = (UCHAR *) slab_alloc( (len+1) * sizeof(UCHAR), POOL_DIRTY, "str_init" );
 	memcpy( str->s,buf,len );
+	str->s[len] = '\0';
 	str->i = len;
 	
 	return str;
@@ -47,9 +50,9 @@ struct obj_str *str_init( UCHAR *buf, long int len ) {
 
 void str_free( struct obj_str *str ) {
 	if( str->s != NULL ) {
-		myfree( str->s, "str_free" );
+		slab_free( str->s, (str->i+1) * sizeof(UCHAR), "str_free" );
 	}
-	myfree( str, "str_free" );
+	pool_free( &str_pool, str, "str_free" );
 }
 
 int str_isValidUTF8( char *string ) {
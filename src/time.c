@@ -18,6 +18,7 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/time.h>
@@ -43,23 +44,58 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 #include "ben.h"
 #include "p2p.h"
 #include "time.h"
+#include "random.h"
+
+/* Immune to wall clock jumps. The coarse clock is served by the vDSO
+ * without a syscall and is precise to a few milliseconds. */
+#ifdef CLOCK_MONOTONIC_COARSE
+#define TIME_CLOCK CLOCK_MONOTONIC_COARSE
+#else
+#define TIME_CLOCK CLOCK_MONOTONIC
+#endif
+
+time_t time_now_sec( void ) {
+	struct timespec ts;
+
+	clock_gettime( TIME_CLOCK, &ts );
+
+	return ts.tv_sec;
+}
+
+/* 64 bit: A 32 bit long overflows after 24.8 days */
+long long int time_now_msec( void ) {
+	struct timespec ts;
+
+	clock_gettime( TIME_CLOCK, &ts );
+
+	return (long long int) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Per-thread generator, random() is not thread-safe */
+unsigned int time_jitter( unsigned int range ) {
+	unsigned int r = 0;
+
+	rand_urandom( &r, sizeof(r) );
+
+	return r % range;
+}
 
 time_t time_add_x_sec( int sec ) {
-	return _main->p2p->time_now.tv_sec + sec;
+	return time_now_sec() + sec;
 }
 
 time_t time_add_1_min( void ) {
-	return _main->p2p->time_now.tv_sec + TIME_1_MINUTE;
+	return time_now_sec() + TIME_1_MINUTE;
 }
 
 time_t time_add_15_min( void ) {
-	return _main->p2p->time_now.tv_sec + TIME_15_MINUTES;
+	return time_now_sec() + TIME_15_MINUTES;
 }
 
 time_t time_add_2_min_approx( void ) {
-	return _main->p2p->time_now.tv_sec + TIME_1_MINUTE + random() % TIME_2_MINUTES;
+	return time_now_sec() + TIME_1_MINUTE + time_jitter( TIME_2_MINUTES );
 }
 
 time_t time_add_5_min_approx( void ) {
-	return _main->p2p->time_now.tv_sec + TIME_4_MINUTES + random() % TIME_2_MINUTES;
+	return time_now_sec() + TIME_4_MINUTES + time_jitter( TIME_2_MINUTES );
 }
@@ -24,6 +24,10 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 #define TIME_5_MINUTES 300
 #define TIME_15_MINUTES 900
 
+time_t time_now_sec( void );
+long long int time_now_msec( void );
+unsigned int time_jitter( unsigned int range );
+
 time_t time_add_x_sec( int sec );
 time_t time_add_1_min( void );
 time_t time_add_15_min( void );
@@ -55,6 +55,9 @@ along with masala.  If not, see <http://www.gnu.org/licenses/>.
 #include "announce.h"
 #include "neighborhood.h"
 
+/* Last maintenance run of this thread. Read without the global mutex. */
+static __thread long long int udp_time_cron = 0;
+
 
 struct obj_udp *udp_init( void ) {
 	struct obj_udp *udp = (struct obj_udp *) myalloc( sizeof(struct obj_udp), "udp_init" );
@@ -190,7 +193,7 @@ void *udp_thread( void *arg ) {
 	log_info( "UDP Thread[%i] - Max events: %i", id, UDP_MAX_EVENTS );
 
 	while( _main->status == MAIN_ONLINE ) {
-		nfds = epoll_wait( _main->udp->epollfd, events, UDP_MAX_EVENTS, CONF_EPOLL_WAIT );
+		nfds = epoll_wait( _main->udp->epollfd, events, UDP_MAX_EVENTS, ( id == 0 ) ? p2p_wait() : CONF_EPOLL_WAIT );
 
 		if( _main->status == MAIN_ONLINE && nfds == -1 ) {
 			if( errno != EINTR ) {
@@ -276,12 +279,18 @@ void udp_input( int sockfd ) {
 			return;
 		} else {
 			p2p_parse( buffer, bytes, &c_addr );
-			udp_cron();
+
+			/* Busy sockets never time out: Run the timers once per tick */
+			if( time_now_msec() - udp_time_cron >= P2P_TICK ) {
+				udp_cron();
+			}
 		}
 	}
 }
 
 void udp_cron( void ) {
+	udp_time_cron = time_now_msec();
+
 	mutex_block( _main->p2p->mutex );
 	p2p_cron();
 	mutex_unblock( _main->p2p->mutex );